@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/sysreg.h"
+
+// Smallest D-cache line in the system (CTR_EL0.DminLine, in words)
+static inline size_t dcache_line_size(void) {
+    return (size_t)4 << ((read_sysreg(ctr_el0) >> 16) & 0xF);
+}
+
+// Write dirty lines covering [start, start + len) back to the point of
+// coherency, for observers that do not snoop the caches, such as a core
+// that still runs with its MMU off.
+static inline void dcache_clean_range(const void *start, size_t len) {
+    size_t line = dcache_line_size();
+    uintptr_t end = (uintptr_t)start + len;
+
+    for (uintptr_t p = (uintptr_t)start & ~(line - 1); p < end; p += line) {
+        __asm__ volatile("dc cvac, %0" :: "r"(p) : "memory");
+    }
+    dsb(sy);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// struct thread offset used by switch.S
+#define THREAD_CPU_CONTEXT 0
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+// Registers a thread keeps across cpu_switch_to(): the AAPCS64
+// callee-saved set, plus sp and the address to resume at. Everything else
+// is either saved by the caller or, for a preempted thread, already in
+// the exception frame on its stack.
+struct cpu_context {
+    uint64_t x19, x20, x21, x22, x23, x24, x25, x26, x27, x28;
+    uint64_t fp;
+    uint64_t sp;
+    uint64_t pc;
+};
+
+// The whole FP/SIMD register file: a preempted thread may be anywhere,
+// so the caller-saved half of the V registers is live too. Laid out for
+// fpsimd.S: q0-q31, then FPSR at 512 and FPCR at 516.
+struct fpsimd_state {
+    __uint128_t vregs[32];
+    uint32_t fpsr;
+    uint32_t fpcr;
+} __attribute__((aligned(16)));
+
+#endif
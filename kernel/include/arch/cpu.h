@@ -0,0 +1,46 @@
+#pragma once
+
+#define MAX_CPUS 8
+#define CACHE_LINE_SIZE 64
+
+// struct cpu_data offsets used by boot.S
+#define CPU_DATA_STACK_TOP 0
+
+#ifndef __ASSEMBLER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/sysreg.h"
+
+#define __cacheline_aligned __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#define MPIDR_AFF_MASK 0xFF00FFFFFFUL
+
+// Per-CPU area. TPIDR_EL1 points at the executing core's entry; boot.S
+// sets it up before any C code runs (see arch/smp.c).
+struct cpu_data {
+    uintptr_t stack_top;
+    unsigned int id;            // logical index, 0 = boot CPU
+    volatile unsigned int online;
+    uint64_t mpidr;             // affinity fields from the DTB "reg"
+} __cacheline_aligned;
+
+_Static_assert(offsetof(struct cpu_data, stack_top) == CPU_DATA_STACK_TOP,
+               "boot.S reads stack_top at CPU_DATA_STACK_TOP");
+
+extern struct cpu_data cpu_data[MAX_CPUS];
+
+static inline struct cpu_data *this_cpu(void) {
+    return (struct cpu_data *)read_sysreg(tpidr_el1);
+}
+
+// Logical index of the executing core, always < MAX_CPUS
+static inline unsigned int cpu_id(void) {
+    return this_cpu()->id;
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile("yield" ::: "memory");
+}
+
+#endif
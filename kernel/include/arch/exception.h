@@ -0,0 +1,44 @@
+#pragma once
+
+// Size of the register frame pushed by kernel_entry in entry.S.
+#define EXC_FRAME_SIZE 272
+
+// Vector table slot, passed to exception_unhandled().
+#define EXC_SYNC_EL1T    0
+#define EXC_IRQ_EL1T     1
+#define EXC_FIQ_EL1T     2
+#define EXC_SERROR_EL1T  3
+#define EXC_SYNC_EL1H    4
+#define EXC_IRQ_EL1H     5
+#define EXC_FIQ_EL1H     6
+#define EXC_SERROR_EL1H  7
+#define EXC_SYNC_EL0_64  8
+#define EXC_IRQ_EL0_64   9
+#define EXC_FIQ_EL0_64   10
+#define EXC_SERROR_EL0_64 11
+#define EXC_SYNC_EL0_32  12
+#define EXC_IRQ_EL0_32   13
+#define EXC_FIQ_EL0_32   14
+#define EXC_SERROR_EL0_32 15
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+struct exception_frame {
+    uint64_t regs[31];  // x0 - x30
+    uint64_t elr;
+    uint64_t spsr;
+    uint64_t pad;       // keeps the frame 16-byte aligned
+};
+
+_Static_assert(sizeof(struct exception_frame) == EXC_FRAME_SIZE,
+               "entry.S frame layout mismatch");
+
+// hot and cold place them in .text.hot and .text.unlikely (linker.ld)
+void exception_unhandled(struct exception_frame *frame, unsigned int type)
+    __attribute__((cold));
+void handle_sync(struct exception_frame *frame);
+void irq_handle(struct exception_frame *frame) __attribute__((hot));
+
+#endif
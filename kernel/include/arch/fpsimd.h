@@ -0,0 +1,29 @@
+#pragma once
+
+#include "arch/context.h"
+#include "arch/cpu.h"
+
+// Lazy FP/SIMD ownership. The kernel itself is built with
+// -mgeneral-regs-only; only code in *_fp.c files may touch the V
+// registers, and only from thread context.
+
+#define CPACR_EL1_FPEN   (3UL << 20)        // no FP/SIMD traps at EL0/EL1
+#define FPSIMD_CPU_NONE  MAX_CPUS           // state is in memory only
+
+struct thread;
+
+void fpsimd_save_state(struct fpsimd_state *state);
+void fpsimd_load_state(const struct fpsimd_state *state);
+
+// Scheduler hook, IRQs masked, before cpu_switch_to(prev, next)
+void fpsimd_switch(struct thread *prev, struct thread *next);
+
+// FP/SIMD access trap (ESR_EL1.EC 0x07) taken by the current thread
+void fpsimd_trap(void);
+
+// Per-CPU trap/save counts
+void fpsimd_dump(void);
+
+// Start threads that check their V registers survive preemption and
+// migration, each logging the result (arch/fpsimd_check_fp.c)
+void fpsimd_check_start(void);
@@ -0,0 +1,44 @@
+#pragma once
+
+// Mask/unmask IRQs on the local CPU (PSTATE.I).
+static inline unsigned long local_irq_save(void) {
+    unsigned long flags;
+    __asm__ volatile("mrs %0, daif\n"
+                     "msr daifset, #2"
+                     : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(unsigned long flags) {
+    __asm__ volatile("msr daif, %0" :: "r"(flags) : "memory");
+}
+
+static inline void local_irq_enable(void) {
+    __asm__ volatile("msr daifclr, #2" ::: "memory");
+}
+
+static inline void local_irq_disable(void) {
+    __asm__ volatile("msr daifset, #2" ::: "memory");
+}
+
+typedef void (*irq_handler_t)(unsigned int irq, void *arg);
+
+// Attach a handler to a GIC interrupt ID and unmask it. SGIs and PPIs are
+// banked, so they are only unmasked on the calling CPU. Returns 0 on
+// success, -1 if the ID is out of range or already claimed.
+int irq_register(unsigned int irq, irq_handler_t handler, void *arg);
+
+// Mask irq and detach its handler. Returns after a grace period, so the
+// handler is no longer running anywhere and its argument may be freed.
+// Thread context only.
+void irq_unregister(unsigned int irq);
+
+// The interrupted context, from inside an IRQ handler (NULL elsewhere)
+struct exception_frame;
+struct exception_frame *irq_frame(void);
+
+// Times irq has been taken, summed over all CPUs
+unsigned long irq_count(unsigned int irq);
+
+// Print every IRQ that has fired, with one count column per online CPU
+void irq_stats_dump(void);
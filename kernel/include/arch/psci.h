@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Power State Coordination Interface (ARM DEN 0022), 64-bit calls
+#define PSCI_VERSION    0x84000000U
+#define PSCI_SYSTEM_OFF 0x84000008U
+#define PSCI_CPU_ON_64  0xC4000003U
+
+#define PSCI_SUCCESS            0
+#define PSCI_NOT_SUPPORTED      -1
+#define PSCI_INVALID_PARAMETERS -2
+#define PSCI_DENIED             -3
+#define PSCI_ALREADY_ON         -4
+#define PSCI_ON_PENDING         -5
+#define PSCI_INTERNAL_FAILURE   -6
+
+// Pick the conduit (hvc/smc) from the DTB /psci node. Returns 0 on
+// success, -1 if firmware does not advertise PSCI.
+int psci_init(void);
+
+// Power on the core with the given MPIDR affinity. It starts at entry
+// (physical address, MMU off) with context in x0.
+int psci_cpu_on(uint64_t mpidr, uintptr_t entry, uintptr_t context);
+
+// Power the machine off (QEMU exits). Returns only if firmware refuses.
+void psci_system_off(void);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "arch/cpu.h"
+
+// Start every core listed under the DTB /cpus node through PSCI CPU_ON.
+// Secondaries get their own stack and cpu_data entry and end up in
+// cpu_idle(). Must run after gic_init().
+void smp_init(void);
+
+// CPUs online. Not the highest ID + 1: a core that timed out at bring-up
+// keeps its slot, so cpu_data[].online is what to iterate by.
+unsigned int smp_cpu_count(void);
+
+// C entry point of a secondary core, called from boot.S
+void secondary_main(struct cpu_data *cpu);
+
+// Per-core idle loop; never returns
+void cpu_idle(void) __attribute__((noreturn));
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// System register access. The register name is pasted into the
+// instruction, so it must be a literal: read_sysreg(esr_el1).
+#define read_sysreg(reg) ({                                  \
+    uint64_t __val;                                          \
+    __asm__ volatile("mrs %0, " #reg : "=r"(__val));         \
+    __val;                                                   \
+})
+
+#define write_sysreg(reg, val)                               \
+    __asm__ volatile("msr " #reg ", %0" :: "r"((uint64_t)(val)))
+
+#define isb()    __asm__ volatile("isb" ::: "memory")
+#define dsb(opt) __asm__ volatile("dsb " #opt ::: "memory")
+#define wfi()    __asm__ volatile("wfi" ::: "memory")
+#define wfe()    __asm__ volatile("wfe" ::: "memory")
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// Microbenchmarks, only built by `make bench`. A case is one iteration of
+// the code under test:
+//
+//   BENCH(memcpy_4k) {
+//       memcpy(dst, src, 4096);
+//   }
+//
+// Cases are collected in the .bench section and run by bench_run_all(),
+// which times every iteration separately and reports min/median/p99.
+// BENCH_SETUP(name, fn) runs fn once before the warmup, for state the
+// iterations share (a cache to allocate from, a buffer to fill).
+
+#define BENCH_WARMUP 16
+#define BENCH_ITERS  256
+
+struct bench_case {
+    const char *name;
+    void (*fn)(void);
+    void (*setup)(void);
+};
+
+#define BENCH_SETUP(name, setup_fn)                                          \
+    static void bench_##name(void);                                          \
+    static const struct bench_case __bench_case_##name                       \
+        __attribute__((used, section(".bench"), aligned(8))) =               \
+        { #name, bench_##name, setup_fn };                                   \
+    static void bench_##name(void)
+
+#define BENCH(name) BENCH_SETUP(name, NULL)
+
+// Keep the compiler from deleting a result nobody reads
+#define bench_keep(x) __asm__ volatile("" :: "r"(x) : "memory")
+
+// Run every registered case on the calling CPU and printk one line each:
+//   bench: <name> n=<iters> min=<v> med=<v> p99=<v> <cycles|ns>
+void bench_run_all(void);
@@ -0,0 +1,18 @@
+#pragma once
+
+#define GIC_IAR_ID_MASK   0x3FF
+#define GIC_SPURIOUS_IRQ  1020
+
+// INTIDs handled: SGIs, PPIs and the first 480 SPIs (QEMU virt has 256)
+#define GIC_MAX_IRQS      512
+
+void gic_init(void);
+void gic_cpu_init(void);
+unsigned int gic_max_irqs(void);
+void gic_enable_irq(unsigned int irq);
+void gic_disable_irq(unsigned int irq);
+
+// Raise software-generated interrupt sgi (0-15) on logical CPU cpu
+void gic_send_sgi(unsigned int cpu, unsigned int sgi);
+unsigned int gic_ack(void);
+void gic_eoi(unsigned int iar);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include "arch/sysreg.h"
+
+// ARM generic timer: the system counter (CNTVCT_EL0) as a monotonic
+// clock, and the per-CPU virtual timer as a one-shot event source.
+
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+typedef void (*timer_handler_t)(void);
+
+// Boot CPU: read CNTFRQ_EL0, precompute the conversions and hook up the
+// virtual timer IRQ (from the DTB, PPI 11 = INTID 27 by default).
+void timer_init(void);
+
+// Every other CPU: enable its (banked) virtual timer PPI
+void timer_cpu_init(void);
+
+// Raw counter value. The ISB keeps the read from being hoisted above
+// earlier instructions, which matters when timing short sequences.
+static inline uint64_t timer_cycles(void) {
+    isb();
+    return read_sysreg(cntvct_el0);
+}
+
+uint64_t timer_freq(void);
+
+// Recalibrate the counter frequency (Hz, 32 bits at most). ktime_ns()
+// stays continuous: the conversions are rebased at the current instant.
+// -1, and nothing changes, for 0 or anything wider than 32 bits.
+int timer_set_freq(uint64_t freq);
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+uint64_t timer_ns_to_cycles(uint64_t ns);
+
+// Nanoseconds since the counter started; no division
+uint64_t ktime_ns(void);
+
+// One-shot on this CPU: handler runs in IRQ context once ktime_ns()
+// reaches deadline_ns. Arming again replaces the previous deadline.
+void timer_set_handler(timer_handler_t handler);
+void timer_arm(uint64_t deadline_ns);
+void timer_cancel(void);
@@ -1,4 +1,57 @@
 #pragma once
 
+#include <stddef.h>
+
+void uart_init(void);
 void uart_putc(char c);
 void uart_puts(const char* str);
+
+// Send a whole span; the TX FIFO is filled in bursts rather than per byte.
+void uart_write(const char* str, size_t len);
+
+// Free bytes in the TX ring; SIZE_MAX while transmit is polled.
+size_t uart_tx_room(void);
+
+// Called from the TX interrupt after it has made room in the ring, so a
+// producer upstream (lib/log.c) can top it up.
+void uart_set_tx_refill(void (*refill)(void));
+
+// Switch TX from busy-waiting to the interrupt-drained ring buffer.
+// Needs the GIC to be initialised.
+void uart_enable_irq(void);
+
+// Block until every queued byte has been handed to the TX FIFO.
+void uart_flush(void);
+
+// Drain the ring and fall back to the polled path (panic/exception use).
+// If tx_lock is held, possibly by the code that faulted, the ring is
+// dropped instead of waited for.
+void uart_force_polled(void);
+
+// Receive. Once uart_enable_irq() has run, the RX interrupts fill a 4 KiB
+// ring and the calls below never touch the UART; before that they poll
+// the FIFO themselves. One consumer at a time.
+struct uart_rx_stats {
+    unsigned long received;
+    unsigned long dropped;      // ring full
+    unsigned long overruns;     // FIFO full before the IRQ was serviced
+    unsigned long errors;       // framing/parity/break, byte discarded
+};
+
+// Oldest unread bytes, in place: *data points into the ring and the
+// return value is how many bytes follow contiguously (0 if none). Data
+// that wraps around the end of the ring takes a second call.
+size_t uart_rx_peek(const char **data);
+
+// Release n bytes of the last uart_rx_peek() span
+void uart_rx_consume(size_t n);
+
+size_t uart_rx_available(void);
+
+// Copying convenience on top of peek/consume; does not wait
+size_t uart_read(char *buf, size_t len);
+
+// Called from the RX interrupt after new bytes were stored
+void uart_set_rx_notify(void (*notify)(void));
+
+void uart_rx_get_stats(struct uart_rx_stats *stats);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// virtio over MMIO (virtio 1.2, section 4.2). QEMU virt has 32 transport
+// slots from 0x0a000000, 0x200 apart, on SPIs 16-47; a slot without a
+// device reads back device ID 0. Both register layouts are handled:
+// version 1 (legacy, QEMU's default) and version 2 (modern, what
+// `make run` asks for with virtio-mmio.force-legacy=false).
+
+#define VIRTIO_ID_NET     1
+#define VIRTIO_ID_BLOCK   2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_MAX_DEVICES 32
+
+// Transport feature bits, after the device-specific ones
+#define VIRTIO_F_VERSION_1 32   // modern device; required on version 2
+
+struct virtio_dev {
+    uintptr_t base;
+    int irq;                    // GIC INTID, -1 if unknown
+    uint32_t device_id;
+    uint32_t version;           // 1 = legacy, 2 = modern
+    bool claimed;
+};
+
+// Split virtqueue (section 2.7). The driver fills descriptors and puts
+// chain heads on the available ring; the device hands them back on the
+// used ring. All fields little-endian, which is also the CPU's order.
+struct virtq_desc {
+    uint64_t addr;              // physical = virtual here
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+#define VIRTQ_DESC_F_NEXT  (1 << 0)
+#define VIRTQ_DESC_F_WRITE (1 << 1)   // device writes the buffer
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT (1 << 0)
+
+struct virtq_used_elem {
+    uint32_t id;                // head of the completed chain
+    uint32_t len;               // bytes the device wrote
+};
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+};
+
+#define VIRTQ_USED_F_NO_NOTIFY (1 << 0)
+
+#define VIRTQ_MAX_SIZE 128
+
+// The drivers poll the used ring, so queues start with interrupts
+// suppressed (VIRTQ_AVAIL_F_NO_INTERRUPT).
+struct virtq {
+    struct virtio_dev *dev;
+    unsigned int index;
+    unsigned int num;           // power of two, at most VIRTQ_MAX_SIZE
+    struct virtq_desc *desc;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    uint16_t free_head;         // free descriptors, linked through next
+    uint16_t num_free;
+    uint16_t avail_idx;         // shadow of avail->idx, ahead until kicked
+    uint16_t last_used;         // next used entry to look at
+    void *cookie[VIRTQ_MAX_SIZE];   // per chain head
+};
+
+// One element of a chain handed to virtq_add()
+struct virtq_buf {
+    const void *addr;
+    uint32_t len;
+    bool write;                 // device-writable (read from the device)
+};
+
+// Find the transports in the DTB ("virtio,mmio"), or scan the QEMU slots
+// without one. Needs page_alloc_init() for the queues set up later.
+void virtio_init(void);
+
+// Claim the first unclaimed device of a type; NULL if there is none
+struct virtio_dev *virtio_find(uint32_t device_id);
+
+// Reset the device and agree on features: wanted & offered, plus
+// VERSION_1 on modern devices. False (and the device marked FAILED) if
+// the device rejects them.
+bool virtio_negotiate(struct virtio_dev *dev, uint64_t wanted, uint64_t *accepted);
+
+// Allocate and register queue index with up to max_num entries. Between
+// virtio_negotiate() and virtio_driver_ok(). Returns 0 or -1.
+int virtq_init(struct virtq *vq, struct virtio_dev *dev, unsigned int index,
+               unsigned int max_num);
+
+void virtio_driver_ok(struct virtio_dev *dev);
+
+// Device-specific configuration space
+uint32_t virtio_config_read32(struct virtio_dev *dev, unsigned int offset);
+uint64_t virtio_config_read64(struct virtio_dev *dev, unsigned int offset);
+
+// Chain count buffers and put the chain on the available ring, without
+// telling the device yet. Returns the head descriptor, or -1 if there are
+// not enough free descriptors. cookie comes back from virtq_get().
+int virtq_add(struct virtq *vq, const struct virtq_buf *bufs, unsigned int count,
+              void *cookie);
+
+// Publish every chain added since the last kick with one notify register
+// write, skipped while the device says it does not need one.
+void virtq_kick(struct virtq *vq);
+
+// Next completed chain: frees its descriptors and returns its cookie, or
+// NULL if the device has not finished anything new. *len (if non-NULL)
+// is the number of bytes the device wrote.
+void *virtq_get(struct virtq *vq, uint32_t *len);
+
+void virtio_dump(void);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// virtio-blk (device 2) on the virtio-mmio transport: `make run
+// DISK=disk.img` attaches a raw image. Requests are synchronous; the
+// caller spins on the used ring with IRQs masked, so use this from
+// thread context, not from an interrupt handler.
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+// After virtio_init(); false if there is no disk
+bool virtio_blk_init(void);
+
+// Disk size in 512-byte sectors; 0 without a disk
+uint64_t virtio_blk_capacity(void);
+bool virtio_blk_read_only(void);
+
+// count sectors starting at sector. Returns 0, or -1 on a device error,
+// a request past the end of the disk, or a write to a read-only disk.
+int virtio_blk_read(uint64_t sector, void *buf, size_t count);
+int virtio_blk_write(uint64_t sector, const void *buf, size_t count);
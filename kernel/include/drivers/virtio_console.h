@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// virtio-console (device 3), transmit only: port 0's transmitq.
+//
+// Writes are copied into 1 KiB DMA buffers. A buffer goes on the queue
+// once it is full, but the device is only notified by
+// virtio_console_flush() (or when every buffer is in flight), so one
+// register write sends a whole batch instead of a byte.
+
+// After virtio_init(); false if there is no console device. Registers
+// the "virtio" console (lib/console.h), which takes the log over from
+// the PL011; the log drainer flushes it at the end of every drain.
+bool virtio_console_init(void);
+bool virtio_console_ready(void);
+
+// Waits, polling the used ring, only when all buffers are in flight
+void virtio_console_write(const char *buf, size_t len);
+
+// Queue the partially filled buffer and notify the device once
+void virtio_console_flush(void);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary streams over the console UART, for data too big to printk: memory
+// snapshots, profiler and trace buffers. A stream is cut into frames of
+// at most BINCHAN_CHUNK bytes, each LZ4-compressed when that helps:
+//
+//   00 A5 'V' 'B'  magic, never produced by printk text
+//   u8  type       BINCHAN_MEMORY, BINCHAN_PROFILE, ...
+//   u8  flags      BINCHAN_F_LZ4, BINCHAN_F_LAST
+//   u16 stream     id, one per binchan_open()
+//   u64 offset     of this chunk in the stream (memory: its address)
+//   u32 raw_len    chunk size before compression
+//   u32 wire_len   payload bytes that follow
+//   payload
+//   u32 crc        CRC-32 of everything after the magic
+//
+// All little-endian. A frame goes out in one uart_write() call, so log
+// text from other CPUs can fall between frames but never inside one;
+// tools/binrecv.py separates the two.
+
+#define BINCHAN_CHUNK 4096
+
+enum binchan_type {
+    BINCHAN_MEMORY  = 1,
+    BINCHAN_PROFILE = 2,
+    BINCHAN_TRACE   = 3,
+    BINCHAN_LOG     = 4,
+};
+
+#define BINCHAN_F_LZ4  (1 << 0)
+#define BINCHAN_F_LAST (1 << 1)
+
+// One stream at a time. Returns false if another stream is open. offset
+// is the first chunk's offset (0, or the address of a memory dump).
+bool binchan_open(enum binchan_type type, uint64_t offset);
+
+// Append to the open stream; a frame is sent every BINCHAN_CHUNK bytes
+void binchan_write(const void *data, size_t len);
+
+// Send what is buffered as the LAST frame and release the channel
+void binchan_close(void);
+
+// A whole region as one BINCHAN_MEMORY stream. Returns false if busy.
+bool binchan_dump_memory(const void *addr, size_t len);
@@ -0,0 +1,14 @@
+#pragma once
+
+// Cold-boot timeline. boot.S stamps CNTVCT_EL0 at its milestones
+// (BOOT_STAMPS_ASM of them, in boot_stamps[]); kernel_main() marks the end
+// of each init phase after that. boot_time_dump() prints the table, with
+// each phase's duration and its offset from _start.
+
+#define BOOT_STAMPS_ASM  5
+#define BOOT_PHASES_MAX  16
+
+// Record that the named phase has just finished. Boot CPU only.
+void boot_mark(const char *phase);
+
+void boot_time_dump(void);
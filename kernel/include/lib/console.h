@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Log outputs. The drainer in lib/log.c hands every console whole spans
+// of formatted text, never single characters, and calls flush() once at
+// the end of each drain so a console can batch.
+//
+// Terminal consoles (CON_TERMINAL) are the ones somebody watches: the PL011
+// or a virtio console. Only the registered terminal with the highest
+// priority gets the log, so registering a better one replaces the one
+// before it without unregistering anything. Every other console (the
+// memory ring) gets everything. After log_panic() only CON_PANIC consoles
+// are used, and write() must then work with IRQs masked.
+//
+// Each console also has a level: records tagged with a higher LOG_LVL_*
+// (printk_level(), the LOG_* macros) are not written to it. Untagged
+// printk() output goes everywhere.
+
+#define CON_TERMINAL (1 << 0)
+#define CON_PANIC    (1 << 1)
+
+// Default level for terminals: make CONSOLE_LEVEL=2 keeps the terminal at
+// errors and warnings while the memory ring still gets everything
+#ifndef CONSOLE_LOG_LEVEL
+#define CONSOLE_LOG_LEVEL 4     // LOG_LVL_DEBUG
+#endif
+
+// Priorities of the built-in consoles
+#define CON_PRIO_UART_POLLED 10
+#define CON_PRIO_UART        20
+#define CON_PRIO_VIRTIO      30
+
+struct console {
+    const char *name;
+    void (*write)(const char *buf, size_t len);
+    void (*flush)(void);                // optional
+    // Optional: bytes write() takes without waiting. The drainer leaves
+    // a record in its ring rather than block, and retries when the
+    // console calls log_drain() after making room.
+    size_t (*room)(void);
+    int priority;
+    int level;                          // 0: the default for its kind
+    unsigned int flags;
+    struct console *next;               // owned by the console list
+};
+
+// Add or remove a console. Thread context with IRQs enabled, or early
+// boot on one CPU: waits for a running drain to finish. Records that were
+// not written yet (before the first console, for instance) go to the new
+// console as well.
+void console_register(struct console *con);
+void console_unregister(struct console *con);
+
+// Change the level of every console with this name at runtime; -1 if
+// there is none
+int console_set_level(const char *name, int level);
+
+void console_list_dump(void);
+
+// Write text straight to the active terminal, bypassing the log rings
+// and the other consoles; waits for room. Thread context.
+void console_write_terminal(const char *buf, size_t len);
+
+// Memory ring console (lib/console_ring.c): the last CONSOLE_RING_SIZE
+// bytes of log output. It lives in a section that nothing clears at boot,
+// with a header that identifies it, so after a warm reset (which keeps
+// RAM) the next boot still has the previous run's log.
+#define CONSOLE_RING_SIZE 16384
+
+// Find the previous run's ring, then start a fresh one for this boot
+void console_ring_init(void);
+
+// Boot number: 1 after a cold boot, +1 for each warm reset since
+unsigned long console_ring_boot(void);
+
+// Copy the newest min(size, stored) bytes of this boot's log to buf;
+// returns the count
+size_t console_ring_read(char *buf, size_t size);
+
+// The same for the previous boot's log; 0 if there was none
+size_t console_ring_read_prev(char *buf, size_t size);
+
+// Print the previous boot's log, if there is one, to the terminal
+void console_ring_dump_prev(void);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, as in zlib and Python's zlib.crc32). Pass 0 to
+// start, or a previous result to continue over more data.
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FDT_MAGIC 0xD00DFEED
+
+// Structure block tokens
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE   0x2
+#define FDT_PROP       0x3
+#define FDT_NOP        0x4
+#define FDT_END        0x9
+
+// All fields are big-endian
+struct fdt_header {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+};
+
+// DTB address handed over by QEMU in x0, saved by boot.S
+extern uintptr_t dtb_address;
+
+// DTB is big-endian
+static inline uint32_t fdt32_to_cpu(uint32_t x) {
+    return __builtin_bswap32(x);
+}
+
+static inline uint64_t fdt64_to_cpu(uint64_t x) {
+    return __builtin_bswap64(x);
+}
+
+// Node offsets are relative to the start of the structure block; the root
+// node is at offset 0. Negative values mean "not found".
+bool fdt_check_header(const void *fdt);
+uint32_t fdt_totalsize(const void *fdt);
+const void *fdt_getprop(const void *fdt, int nodeoffset,
+                        const char *name, int *lenp);
+
+// #address-cells / #size-cells that apply to the children of a node
+int fdt_address_cells(const void *fdt, int nodeoffset);
+int fdt_size_cells(const void *fdt, int nodeoffset);
+
+// Read a 1- or 2-cell big-endian number and advance the cursor
+uint64_t fdt_read_cells(const uint32_t **cells, int count);
+
+// Boot-time index (lib/fdt_index.c). fdt_index_init() walks the blob once;
+// the lookups below are then hash-table hits instead of rescans. They all
+// work on the indexed blob and return structure block offsets.
+int fdt_index_init(const void *fdt);
+const void *fdt_blob(void);
+int fdt_find_node(const char *path);
+int fdt_find_compatible(int from, const char *compatible);  // from = -1 to start
+int fdt_find_phandle(uint32_t phandle);
+int fdt_parent(int offset);
+int fdt_next_child(int parent, int prev);          // prev = -1 to start
+bool fdt_get_reg(int offset, unsigned int index, uint64_t *addr, uint64_t *size);
+int fdt_get_irq(int offset, unsigned int index);   // GIC INTID or -1
+void fdt_index_dump(void);
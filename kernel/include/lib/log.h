@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-CPU log rings (lib/log.c). printk formats straight into a record
+// reserved in the ring of the executing CPU; a single drainer merges the
+// rings in timestamp order and writes them to the consoles (lib/console.h).
+
+#define LOG_RECORD_MAX 256      // text bytes per record
+#define LOG_DEFER_MAX_ARGS 8
+
+struct log_slot {
+    char *data;                 // LOG_RECORD_MAX bytes, contiguous
+    uint64_t stamp;
+    unsigned long irq_flags;
+    uint8_t level;              // LOG_LVL_*, set by the caller
+};
+
+// Reserve a record on this CPU's ring. IRQs stay masked until the
+// matching log_commit(). Returns false (and counts a drop) if the ring is
+// full; the producer never waits for the drainer.
+bool log_reserve(struct log_slot *slot);
+void log_commit(struct log_slot *slot, size_t len);
+
+// Binary record: format pointer plus argc raw words, formatted only when
+// drained. Does not drain itself; use through LOG_DEFER() in printk.h.
+void log_deferred(int level, const char *fmt, const uint64_t *argv, unsigned int argc);
+
+// Move committed records to the consoles for as long as they have room. Returns
+// at once if another CPU is already draining; that CPU picks up the new
+// records before it lets go.
+void log_drain(void) __attribute__((hot));
+
+// After a fatal error: drain without waiting for, or respecting, the
+// drainer lock, and keep doing so for every later record.
+void log_panic(void) __attribute__((cold));
+
+// Hook the drainer onto the UART TX interrupt and start the memory ring
+// console
+void log_init(void);
+
+unsigned long log_dropped(void);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ4 block format (no frame header), decodable by any LZ4 library or by
+// tools/binrecv.py. Inputs are limited to 64 KiB so match positions fit
+// 16 bits.
+#define LZ4_MAX_INPUT 65535
+#define LZ4_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+
+// Compress len bytes of src into dst, which must hold
+// LZ4_COMPRESS_BOUND(len) bytes. Returns the compressed size. Not
+// reentrant: the match table is static.
+size_t lz4_compress(const void *src, size_t len, void *dst);
@@ -3,21 +3,162 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "colors.h"
+#include "lib/log.h"
 
-void printk(const char *format, ...);
-void hex_dump(void *addr, size_t len);
+// gcc checks the arguments of every printk-style call against its format
+#define __printf(fmt_idx, arg_idx) __attribute__((format(printf, fmt_idx, arg_idx)))
+
+void printk(const char *format, ...) __printf(1, 2);
+
+// printk with a LOG_LVL_* tag on the record, for consoles that filter
+// (lib/console.h). Plain printk() is LOG_LVL_NONE: shown everywhere.
+void printk_level(int level, const char *format, ...) __printf(2, 3);
+void hex_dump(const void *addr, size_t len);
+
+// hex_dump into buf instead of the log: whole rows only, NUL-terminated;
+// returns the number of characters stored.
+size_t hex_dump_to(char *buf, size_t size, const void *addr, size_t len);
+
+// Format into str (always NUL-terminated, truncated to fit); returns the
+// number of characters stored.
+int snprintk(char *str, size_t size, const char *format, ...) __printf(3, 4);
+
+// Compiled formats: a call site keeps one of these next to its literal
+// format. The first call parses the format into ops, each one a literal
+// run plus the parsed conversion after it, and every later call replays
+// them, so flags, width and precision are never parsed again. Formats
+// with more than PRINTK_FMT_OPS - 1 conversions are always parsed.
+#define PRINTK_FMT_OPS 8
+
+struct printk_fmt_op {
+    uint16_t lit_off;           // literal text before the conversion
+    uint16_t lit_len;
+    uint8_t type;               // conversion character; 0 for the tail
+    uint8_t flags;
+    uint16_t width;
+    uint16_t precision;
+};
+
+struct printk_fmt {
+    const char *format;
+    unsigned int state;
+    unsigned int nops;
+    struct printk_fmt_op ops[PRINTK_FMT_OPS];
+};
+
+#define PRINTK_FMT_INIT(fmt) { .format = (fmt) }
+
+// printk_level() and snprintk() with a compiled format. The format check
+// is up to the caller; __PRINTK() below does both.
+void printk_fmt(int level, struct printk_fmt *pf, ...);
+int snprintk_fmt(char *str, size_t size, struct printk_fmt *pf, ...);
+
+// Same, with the arguments taken from 64-bit words (deferred log records)
+int snprintk_raw(char *str, size_t size, const char *format,
+                 const uint64_t *argv, unsigned int argc);
+
+// Compile-time threshold: make LOG_LEVEL=2 keeps errors and warnings and
+// removes every lower-level call, arguments included. -DDEBUG or
+// -DLOG_LEVEL_DEBUG keep raising the default to LOG_LVL_DEBUG.
+#define LOG_LVL_NONE  0
+#define LOG_LVL_ERROR 1
+#define LOG_LVL_WARN  2
+#define LOG_LVL_INFO  3
+#define LOG_LVL_DEBUG 4
+
+#ifndef LOG_LEVEL
+    #if defined(DEBUG) || defined(LOG_LEVEL_DEBUG)
+        #define LOG_LEVEL LOG_LVL_DEBUG
+    #else
+        #define LOG_LEVEL LOG_LVL_INFO
+    #endif
+#endif
+
+// Deferred records: LOG_DEFER(fmt, ...) stores the format pointer and up
+// to LOG_DEFER_MAX_ARGS arguments, each widened to 64 bits, and leaves
+// formatting to the log drainer (or to tools/logdecode.py). %s arguments
+// must outlive the record, so only pass string literals.
+#define LOG_DEFER(fmt, ...) __LOG_DEFER(LOG_LVL_NONE, fmt, ##__VA_ARGS__)
+
+#define __LOG_DEFER(level, fmt, ...)                                                   \
+    do {                                                                               \
+        if (0) printk(fmt, ##__VA_ARGS__);                                             \
+        log_deferred(level, fmt, (const uint64_t[]){ 0 __LOG_WIDEN(__VA_ARGS__) } + 1, \
+                     __LOG_NARGS(__VA_ARGS__));                                        \
+    } while (0)
+
+#define __LOG_NARGS(...) __LOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define __LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define __LOG_WIDEN(...) __LOG_WIDEN_N(__LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define __LOG_WIDEN_N(n, ...) __LOG_WIDEN_CAT(__LOG_WIDEN_, n)(__VA_ARGS__)
+#define __LOG_WIDEN_CAT(a, b) __LOG_WIDEN_CAT_(a, b)
+#define __LOG_WIDEN_CAT_(a, b) a##b
+#define __LOG_W(x) , (uint64_t)(x)
+#define __LOG_WIDEN_0()
+#define __LOG_WIDEN_1(a) __LOG_W(a)
+#define __LOG_WIDEN_2(a, ...) __LOG_W(a) __LOG_WIDEN_1(__VA_ARGS__)
+#define __LOG_WIDEN_3(a, ...) __LOG_W(a) __LOG_WIDEN_2(__VA_ARGS__)
+#define __LOG_WIDEN_4(a, ...) __LOG_W(a) __LOG_WIDEN_3(__VA_ARGS__)
+#define __LOG_WIDEN_5(a, ...) __LOG_W(a) __LOG_WIDEN_4(__VA_ARGS__)
+#define __LOG_WIDEN_6(a, ...) __LOG_W(a) __LOG_WIDEN_5(__VA_ARGS__)
+#define __LOG_WIDEN_7(a, ...) __LOG_W(a) __LOG_WIDEN_6(__VA_ARGS__)
+#define __LOG_WIDEN_8(a, ...) __LOG_W(a) __LOG_WIDEN_7(__VA_ARGS__)
+
+// make PRINTK_COMPILED=1 gives every LOG_* call site its own compiled
+// format; the if (0) keeps gcc checking the arguments against it.
+#ifdef PRINTK_COMPILED
+    #define __PRINTK(level, fmt, ...)                                   \
+        do {                                                            \
+            static struct printk_fmt __pf = PRINTK_FMT_INIT(fmt);       \
+            if (0) printk(fmt, ##__VA_ARGS__);                          \
+            printk_fmt(level, &__pf, ##__VA_ARGS__);                    \
+        } while (0)
+#else
+    #define __PRINTK(level, fmt, ...) printk_level(level, fmt, ##__VA_ARGS__)
+#endif
+
+// make LOG_DEFERRED=1 routes LOG_WARN/INFO/DEBUG through LOG_DEFER.
+// Errors are always formatted on the spot.
+#ifdef LOG_DEFERRED
+    #define __LOG_EMIT(level, fmt, ...) __LOG_DEFER(level, fmt, ##__VA_ARGS__)
+#else
+    #define __LOG_EMIT(level, fmt, ...) __PRINTK(level, fmt, ##__VA_ARGS__)
+#endif
+
+// A removed call still type-checks its arguments and keeps variables that
+// are only logged "used", but generates no code.
+#define __LOG_NOP(fmt, ...) do { if (0) printk(fmt, ##__VA_ARGS__); } while (0)
 
 // Log levels (all aligned to 7 chars + space)
-#define LOG_ERROR(fmt, ...) printk(COLOR_RED "[ERROR]" COLOR_RESET " " fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  printk(COLOR_YELLOW "[WARN]" COLOR_RESET "  " fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  printk("[INFO]" "  " fmt, ##__VA_ARGS__)
+#if LOG_LEVEL >= LOG_LVL_ERROR
+    #define LOG_ERROR(fmt, ...) __PRINTK(LOG_LVL_ERROR, COLOR_RED "[ERROR]" COLOR_RESET " " fmt, ##__VA_ARGS__)
+#else
+    #define LOG_ERROR(fmt, ...) __LOG_NOP(fmt, ##__VA_ARGS__)
+#endif
+
+// LOG_WARN_NOW is formatted on the spot even with LOG_DEFERRED, for %s
+// arguments that do not outlive the call
+#if LOG_LEVEL >= LOG_LVL_WARN
+    #define LOG_WARN(fmt, ...)  __LOG_EMIT(LOG_LVL_WARN, COLOR_YELLOW "[WARN]" COLOR_RESET "  " fmt, ##__VA_ARGS__)
+    #define LOG_WARN_NOW(fmt, ...) __PRINTK(LOG_LVL_WARN, COLOR_YELLOW "[WARN]" COLOR_RESET "  " fmt, ##__VA_ARGS__)
+#else
+    #define LOG_WARN(fmt, ...)  __LOG_NOP(fmt, ##__VA_ARGS__)
+    #define LOG_WARN_NOW(fmt, ...) __LOG_NOP(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL >= LOG_LVL_INFO
+    #define LOG_INFO(fmt, ...)  __LOG_EMIT(LOG_LVL_INFO, "[INFO]" "  " fmt, ##__VA_ARGS__)
+#else
+    #define LOG_INFO(fmt, ...)  __LOG_NOP(fmt, ##__VA_ARGS__)
+#endif
 
-// DEBUG logs: enabled with -DDEBUG or -DLOG_LEVEL_DEBUG
-#if defined(DEBUG) || defined(LOG_LEVEL_DEBUG)
-    #define LOG_DEBUG(fmt, ...) printk(COLOR_CYAN "[DEBUG]" COLOR_RESET " " fmt, ##__VA_ARGS__)
+#if LOG_LEVEL >= LOG_LVL_DEBUG
+    #define LOG_DEBUG(fmt, ...) __LOG_EMIT(LOG_LVL_DEBUG, COLOR_CYAN "[DEBUG]" COLOR_RESET " " fmt, ##__VA_ARGS__)
 #else
-    #define LOG_DEBUG(fmt, ...) ((void)0)
+    #define LOG_DEBUG(fmt, ...) __LOG_NOP(fmt, ##__VA_ARGS__)
 #endif
 
 #endif
@@ -0,0 +1,24 @@
+#pragma once
+
+// Read-copy-update in its simplest, scheduler-based form.
+//
+// A read-side section is any stretch of code that cannot be preempted:
+// IRQ handlers, code with IRQs masked, or code between rcu_read_lock()
+// and rcu_read_unlock(). Readers never write shared memory and never
+// wait. A writer publishes a new version with rcu_assign_pointer(), then
+// synchronize_rcu() returns once every CPU has passed through the
+// scheduler (a quiescent state), so no reader can still hold the old
+// version and it may be freed.
+
+#define rcu_dereference(p)        __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v)  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+// Wait for a grace period. Thread context only, outside any read-side
+// section.
+void synchronize_rcu(void);
+
+// Called by the scheduler on every pass through schedule()
+void rcu_note_qs(void);
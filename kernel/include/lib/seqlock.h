@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include "arch/cpu.h"
+#include "lib/spinlock.h"
+
+// Sequence lock for small read-mostly data. Readers take no lock and never
+// write shared memory; they retry if a writer was active:
+//
+//   do {
+//       seq = read_seqbegin(&sl);
+//       copy = data;
+//   } while (read_seqretry(&sl, seq));
+//
+// The count is odd while a write is in progress. Writers are serialised
+// by the embedded spinlock and must not be interrupted by a reader on the
+// same CPU (take it with IRQs masked if readers run in IRQ context).
+typedef struct {
+    volatile unsigned int seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT { 0, SPINLOCK_INIT }
+
+static inline unsigned int read_seqbegin(const seqlock_t *sl) {
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, unsigned int start) {
+    // Order the data reads before the second look at the count
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    // Make the odd count visible before any of the data stores
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_sequnlock(seqlock_t *sl) {
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+    spin_unlock(&sl->lock);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Line commands on the PL011: type "stats" and Enter on the QEMU terminal.
+// Input is not echoed, since the log owns the terminal. Commands run in
+// the UART RX interrupt, so they may only print.
+
+// After uart_enable_irq(): takes the UART receive ring as its consumer
+void shell_init(void);
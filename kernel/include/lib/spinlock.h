@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/irq.h"
+
+// Ticket lock: taking a ticket is one atomic add on next, and the lock is
+// granted in ticket order, so no CPU can starve. Exclusives need Normal
+// cacheable memory, so these may only be used once the MMU is on.
+//
+// Waiters sleep in WFE instead of spinning on the bus. LDAXRH arms the
+// exclusive monitor on owner; the holder's store-release to owner in
+// spin_unlock() clears every monitor on that line, which is a wakeup event
+// for the waiting cores, so no explicit SEV is needed.
+//
+// Built with LSE=1 (-march=armv8.1-a) the ticket add becomes a single
+// LDADDA and spin_trylock()'s compare-exchange a CASA.
+typedef union {
+    volatile uint32_t val;
+    struct {
+        volatile uint16_t owner;    // ticket being served (low half)
+        volatile uint16_t next;     // next ticket to hand out
+    };
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+#define SPINLOCK_TICKET (1U << 16)
+
+static inline uint16_t spin_load_exclusive(volatile uint16_t *owner) {
+    uint32_t val;
+    __asm__ volatile("ldaxrh %w0, %1" : "=r"(val) : "Q"(*owner) : "memory");
+    return (uint16_t)val;
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    uint32_t old = __atomic_fetch_add(&lock->val, SPINLOCK_TICKET, __ATOMIC_ACQUIRE);
+    uint16_t ticket = old >> 16;
+
+    if ((uint16_t)old == ticket) {
+        return;
+    }
+    while (spin_load_exclusive(&lock->owner) != ticket) {
+        wfe();
+    }
+}
+
+static inline bool spin_trylock(spinlock_t *lock) {
+    uint32_t old = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+
+    if ((uint16_t)old != (old >> 16)) {
+        return false;
+    }
+    return __atomic_compare_exchange_n(&lock->val, &old, old + SPINLOCK_TICKET,
+                                       false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    // Only the holder writes owner
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline bool spin_is_locked(spinlock_t *lock) {
+    uint32_t val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    return (uint16_t)val != (val >> 16);
+}
+
+static inline unsigned long spin_lock_irqsave(spinlock_t *lock) {
+    unsigned long flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "arch/cpu.h"
+
+// Per-CPU event counters. Every CPU counts in its own cache line with a
+// plain load and store, no atomics, and CPUs never write each other's
+// lines; stat_read() adds the CPUs up when somebody asks. An IRQ that
+// bumps the same counter on the same CPU between that load and store
+// loses one count, which is why most counting sites already have IRQs
+// masked.
+
+enum stat_id {
+    STAT_UART_TX_BYTES,         // bytes written to the PL011 data register
+    STAT_UART_TX_STALLS,        // writes that found the TX FIFO or ring full
+    STAT_PRINTK,                // printk records
+    STAT_IRQS,
+    STAT_PAGE_ALLOCS,           // alloc_page() and alloc_pages()
+    STAT_SLAB_ALLOCS,           // kmem_cache_alloc()
+    STAT_CTX_SWITCHES,
+    STAT_TIMERS,                // ktimer callbacks run
+    NR_STATS,
+};
+
+struct stat_cpu {
+    unsigned long count[NR_STATS];
+} __cacheline_aligned;
+
+extern struct stat_cpu stat_cpus[MAX_CPUS];
+
+static inline void stat_add(enum stat_id id, unsigned long n) {
+    stat_cpus[cpu_id()].count[id] += n;
+}
+
+static inline void stat_inc(enum stat_id id) {
+    stat_add(id, 1);
+}
+
+// Sum over all CPUs; one CPU's count with stat_read_cpu()
+unsigned long stat_read(enum stat_id id);
+unsigned long stat_read_cpu(enum stat_id id, unsigned int cpu);
+
+// One row per counter: the total, then each online CPU
+void stats_dump(void);
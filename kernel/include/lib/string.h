@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+// lib/string.S. These need the MMU on (unaligned accesses, DC ZVA).
+void *memset(void *dst, int c, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
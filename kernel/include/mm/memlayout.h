@@ -1,5 +1,32 @@
 #pragma once
 
+// Constants here are shared with boot.S, so no C-only suffixes unless
+// they go through UL().
+#ifdef __ASSEMBLER__
+#define UL(x) x
+#else
+#define __UL(x) x##UL
+#define UL(x) __UL(x)
+#endif
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (UL(1) << PAGE_SHIFT)
+
+// QEMU virt physical map. The early page tables identity-map both regions
+// with 1 GiB level-1 blocks.
+#define DEVICE_BASE UL(0x00000000)   // GIC, PL011, virtio-mmio, ...
+#define DEVICE_SIZE UL(0x40000000)
+#define RAM_BASE    UL(0x40000000)   // kernel image is loaded here
+#define RAM_MAP_SIZE UL(0x40000000)  // RAM covered by the early map
+
+// Used when no usable /memory node is found (matches `make run`)
+#define RAM_DEFAULT_SIZE UL(0x10000000)
+
+#define PAGE_ALIGN(x)      (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
+
+#ifndef __ASSEMBLER__
+
 #include <stdint.h>
 
 extern char __kernel_start[];
@@ -22,3 +49,5 @@ static inline uintptr_t bss_start_phys(void) {
 static inline uintptr_t bss_end_phys(void) {
     return (uintptr_t)__bss_end;
 }
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "mm/memlayout.h"
+
+// Translation regime set up by boot.S: 4 KiB granule, 39-bit VA, so the
+// walk starts at level 1 and each level-1 entry maps 1 GiB.
+#define L1_SHIFT 30
+
+// MAIR_EL1 attribute indexes
+#define MT_DEVICE_nGnRE 0
+#define MT_NORMAL       1
+
+#define MAIR_DEVICE_nGnRE UL(0x04)
+#define MAIR_NORMAL_WB    UL(0xFF)   // inner/outer write-back, RW-allocate
+#define MAIR_VALUE ((MAIR_DEVICE_nGnRE << (8 * MT_DEVICE_nGnRE)) | \
+                    (MAIR_NORMAL_WB << (8 * MT_NORMAL)))
+
+// Block/page descriptor bits
+#define PTE_TYPE_BLOCK  UL(1)
+#define PTE_ATTRINDX(n) (UL(n) << 2)
+#define PTE_SH_INNER    (UL(3) << 8)
+#define PTE_AF          (UL(1) << 10)
+#define PTE_PXN         (UL(1) << 53)
+#define PTE_UXN         (UL(1) << 54)
+
+#define PTE_NORMAL_BLOCK (PTE_TYPE_BLOCK | PTE_ATTRINDX(MT_NORMAL) | \
+                          PTE_SH_INNER | PTE_AF)
+#define PTE_DEVICE_BLOCK (PTE_TYPE_BLOCK | PTE_ATTRINDX(MT_DEVICE_nGnRE) | \
+                          PTE_AF | PTE_PXN | PTE_UXN)
+
+// TCR_EL1 (IPS is filled in at runtime from ID_AA64MMFR0_EL1)
+#define TCR_T0SZ        (64 - 39)
+#define TCR_IRGN0_WBWA  (UL(1) << 8)
+#define TCR_ORGN0_WBWA  (UL(1) << 10)
+#define TCR_SH0_INNER   (UL(3) << 12)
+#define TCR_TG0_4K      (UL(0) << 14)
+#define TCR_EPD1        (UL(1) << 23)   // no TTBR1 walks
+#define TCR_IPS_SHIFT   32
+#define TCR_VALUE (TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | \
+                   TCR_SH0_INNER | TCR_TG0_4K | TCR_EPD1)
+
+// SCTLR_EL1
+#define SCTLR_M (UL(1) << 0)    // MMU enable
+#define SCTLR_C (UL(1) << 2)    // data cache enable
+#define SCTLR_I (UL(1) << 12)   // instruction cache enable
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include "arch/sysreg.h"
+
+static inline bool mmu_enabled(void) {
+    return read_sysreg(sctlr_el1) & SCTLR_M;
+}
+
+#endif
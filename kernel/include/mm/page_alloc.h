@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+// Largest block is 2^(PAGE_MAX_ORDER - 1) pages (4 MiB)
+#define PAGE_MAX_ORDER 11
+
+// Hand RAM between the end of the kernel image and the end of the DTB
+// /memory range to the allocator. Needs fdt_index_init() to have run;
+// without a DTB, RAM_DEFAULT_SIZE is assumed.
+void page_alloc_init(void);
+
+// Physically contiguous, naturally aligned 2^order pages; NULL when out
+// of memory. Memory is identity-mapped, so the pointer is also the PA.
+void *alloc_pages(unsigned int order);
+void free_pages(void *addr, unsigned int order);
+
+// Single-page fast path (O(1) from the hot page cache)
+void *alloc_page(void);
+void free_page(void *addr);
+
+// As above, but cleared (DC ZVA through memset)
+void *alloc_pages_zeroed(unsigned int order);
+void *alloc_page_zeroed(void);
+
+size_t page_alloc_free_count(void);
+void page_alloc_dump(void);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+struct kmem_cache;
+
+// Create a cache of fixed-size objects. align of 0 means pointer alignment.
+// Returns NULL if the cache table is full or size is too large.
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align);
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+// Print hit/miss and fragmentation counters
+void kmem_cache_dump(const struct kmem_cache *cache);
+void kmem_cache_dump_all(void);
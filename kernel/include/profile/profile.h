@@ -0,0 +1,38 @@
+#pragma once
+
+// Sampling profiler, only built by `make profile` (PROFILE_BUILD). The PMU
+// cycle counter interrupts every PROFILE_PERIOD cycles and the handler
+// records the interrupted PC plus a frame-pointer backtrace. At the end
+// of the run profile_dump() sends every sample over the binary channel
+// (lib/binchan.h), for tools/profile.py to symbolize against the ELF.
+
+#define PROFILE_DEPTH   8       // PC + 7 callers per sample
+#define PROFILE_SAMPLES 2048    // per CPU; later samples are counted, not kept
+
+#ifndef PROFILE_PERIOD
+#define PROFILE_PERIOD  250000  // cycles; 4 kHz on QEMU's 1 GHz counter
+#endif
+
+#ifdef PROFILE_BUILD
+
+// Boot CPU, after gic_init(): find the PMU IRQ and start sampling
+void profile_init(void);
+
+// Each secondary
+void profile_cpu_init(void);
+
+// Stop recording on every CPU. Samples already taken stay.
+void profile_stop(void);
+
+// Send the samples (after profile_stop()) as a BINCHAN_PROFILE stream:
+//   u32 depth, u32 period, u64 base, u32 samples, u32 dropped
+//   per sample: u8 cpu, u8 n, n x u32 (address - base), PC first
+// All fields little-endian.
+void profile_dump(void);
+
+#else
+
+static inline void profile_init(void) {}
+static inline void profile_cpu_init(void) {}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel timeouts on a per-CPU hierarchical timer wheel. Adding and
+// cancelling a timer are O(1) list operations, and there is no periodic
+// tick: each CPU's virtual timer is programmed for the earliest pending
+// timeout only, and not at all when there is none, so an idle core stays
+// in WFI until something actually needs it.
+//
+// Deadlines are rounded up to wheel units of 2^20 ns (about 1 ms), and
+// further out to coarser ones: a timeout fires late by less than 8/63
+// (just over 1/8) of its distance plus one unit, never early. See
+// docs/timer.md.
+
+typedef void (*ktimer_fn_t)(void *arg);
+
+struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;      // NULL while not pending
+    uint64_t expires;           // in wheel units
+    ktimer_fn_t fn;
+    void *arg;
+    unsigned int cpu;           // whose wheel it is on
+    unsigned int slot;          // level * 64 + index there
+};
+
+#define KTIMER_INIT(fn_, arg_) { .fn = (fn_), .arg = (arg_) }
+
+// Boot CPU, after timer_init(): takes over the timer interrupt
+void ktimers_init(void);
+
+void ktimer_init(struct ktimer *timer, ktimer_fn_t fn, void *arg);
+
+// fn(arg) runs once, in IRQ context on the calling CPU, when ktime_ns()
+// has reached deadline_ns. A pending timer is moved. One timer must not
+// be added or cancelled by two CPUs at the same time.
+void ktimer_add(struct ktimer *timer, uint64_t deadline_ns);
+void ktimer_add_after(struct ktimer *timer, uint64_t delta_ns);
+
+// True if it was pending. Does not wait for a callback already running.
+bool ktimer_cancel(struct ktimer *timer);
+
+static inline bool ktimer_pending(const struct ktimer *timer) {
+    return __atomic_load_n(&timer->pprev, __ATOMIC_RELAXED) != NULL;
+}
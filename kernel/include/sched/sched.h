@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/context.h"
+
+// Kernel threads, round-robin on per-CPU run queues. A thread runs until
+// it yields, exits or its time slice ends; preemption happens only on the
+// way out of an IRQ, so code running with IRQs masked (which includes
+// every spin_lock_irqsave() section) is never preempted.
+
+#define THREAD_STACK_ORDER 2                    // 16 KiB, like the boot stacks
+#define SCHED_SLICE_NS     (10 * 1000 * 1000)   // 10 ms
+#define IPI_RESCHEDULE     0                    // SGI used to kick an idle CPU
+
+enum thread_state {
+    THREAD_READY,       // on a run queue
+    THREAD_RUNNING,
+    THREAD_DEAD,        // freed by the next thread to run on its CPU
+};
+
+struct thread {
+    struct cpu_context ctx;         // THREAD_CPU_CONTEXT
+    struct thread *next;            // run queue link
+    const char *name;
+    unsigned int id;
+    unsigned int cpu;               // CPU it last ran on
+    enum thread_state state;
+    volatile unsigned int on_cpu;   // context still live on some CPU
+    unsigned int preempt_count;
+    void *stack;
+    unsigned int fpsimd_cpu;        // CPU whose V registers hold fpsimd
+    struct fpsimd_state fpsimd;     // saved only if the thread used FP
+};
+
+typedef void (*thread_fn_t)(void *arg);
+
+// Boot CPU, after gic_init() and ktimers_init() and before smp_init(): the
+// code already running becomes CPU 0's idle thread.
+void sched_init(void);
+
+// Each secondary, from secondary_main()
+void sched_cpu_init(void);
+
+// Create a runnable thread on the calling CPU's queue and wake an idle
+// CPU to steal it. Returns NULL if memory runs out.
+struct thread *thread_create(const char *name, thread_fn_t fn, void *arg);
+
+void thread_yield(void);
+void thread_exit(void) __attribute__((noreturn));
+struct thread *current_thread(void);
+
+// Keep the current thread on this CPU without masking IRQs
+void preempt_disable(void);
+void preempt_enable(void);
+
+// Pick the next thread and switch to it; a no-op if there is nothing
+// else to run. Safe from thread context and at IRQ exit.
+void schedule(void);
+
+// Called by irq_handle() after the EOI
+void sched_irq_exit(void);
+
+// Anything for an idle CPU to do: local work, or queued work to steal
+bool sched_work_pending(void);
+
+// Called with the thread that ran before, from the new thread's context
+void sched_finish_switch(struct thread *prev);
+
+void sched_dump(void);
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include "arch/cpu.h"
+#include "arch/fpsimd.h"
+#include "arch/sysreg.h"
+#include "lib/printk.h"
+#include "sched/sched.h"
+
+// FP/SIMD registers are handed to a thread only when it first uses them.
+//
+// Every switch turns FP access off (CPACR_EL1.FPEN = 0). A thread that then
+// executes an FP/SIMD instruction traps into fpsimd_trap(), which turns
+// access back on and loads its saved state. When a thread that used FP is
+// switched out, its registers are saved. A thread that never touches FP
+// costs one CPACR write per switch, and its 528-byte state is never
+// copied.
+//
+// If a thread comes back to a CPU whose registers still hold its state
+// (nobody else loaded theirs in between, and it has not used FP on
+// another CPU since), access is simply turned back on without trapping:
+//
+//   fpsimd_owner[cpu] == next && next->fpsimd_cpu == cpu  ->  still valid
+
+struct fpsimd_stats {
+    unsigned long traps;    // lazy loads
+    unsigned long saves;
+} __cacheline_aligned;
+
+static struct thread *fpsimd_owner[MAX_CPUS];
+static struct fpsimd_stats fpsimd_stats[MAX_CPUS];
+
+static inline bool fpsimd_enabled(void) {
+    return (read_sysreg(cpacr_el1) & CPACR_EL1_FPEN) == CPACR_EL1_FPEN;
+}
+
+static inline void fpsimd_set_access(bool on) {
+    write_sysreg(cpacr_el1, on ? CPACR_EL1_FPEN : 0);
+    isb();
+}
+
+void fpsimd_switch(struct thread *prev, struct thread *next) {
+    unsigned int cpu = cpu_id();
+
+    // Access is only on if prev used FP during this slice, in which case
+    // it owns the registers.
+    if (fpsimd_enabled()) {
+        if (prev->state == THREAD_DEAD) {
+            fpsimd_owner[cpu] = NULL;
+        } else {
+            fpsimd_save_state(&prev->fpsimd);
+            fpsimd_stats[cpu].saves++;
+        }
+    }
+
+    fpsimd_set_access(fpsimd_owner[cpu] == next && next->fpsimd_cpu == cpu);
+}
+
+void fpsimd_trap(void) {
+    unsigned int cpu = cpu_id();
+    struct thread *thread = current_thread();
+
+    fpsimd_set_access(true);
+    if (!thread) {
+        return;     // before sched_init(): nothing to load yet
+    }
+
+    fpsimd_load_state(&thread->fpsimd);
+    fpsimd_owner[cpu] = thread;
+    thread->fpsimd_cpu = cpu;
+    fpsimd_stats[cpu].traps++;
+}
+
+void fpsimd_dump(void) {
+    LOG_INFO("fpsimd: lazy loads and saves per CPU\n");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu_data[cpu].online) {
+            printk("        cpu%u: %lu loads, %lu saves\n",
+                   cpu, fpsimd_stats[cpu].traps, fpsimd_stats[cpu].saves);
+        }
+    }
+}
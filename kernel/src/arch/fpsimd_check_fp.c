@@ -0,0 +1,79 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/fpsimd.h"
+#include "lib/printk.h"
+#include "sched/sched.h"
+
+// Exercise the lazy FP/SIMD switch from real threads. Each one fills all
+// 32 V registers with a pattern of its own, spins with them live long
+// enough to be preempted (and often stolen by another CPU), then stores
+// them and checks the pattern. A save or load that goes to the wrong
+// thread, or does not happen, shows up as a wrong register.
+//
+// The first fill traps into fpsimd_trap(); every preemption with the
+// pattern loaded saves it in fpsimd_switch().
+
+#define FPSIMD_CHECK_THREADS 4
+#define FPSIMD_CHECK_ROUNDS  8
+#define FPSIMD_CHECK_SPIN    (1UL << 21)    // ~2 slices under TCG
+
+static unsigned int fpsimd_check_done;
+
+// Fill v0-v31 with pat, pat + 1, ... in both lanes, spin, then store them
+static void fpsimd_check_round(uint64_t pat, uint64_t out[32][2]) {
+    unsigned long spin = FPSIMD_CHECK_SPIN;
+
+    __asm__ volatile(
+        "mov x9, %[pat]\n"
+        ".irp n, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+        "dup v\\n\\().2d, x9\n"
+        "add x9, x9, #1\n"
+        ".endr\n"
+        "1: subs %[spin], %[spin], #1\n"
+        "b.ne 1b\n"
+        ".irp n, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+        "str q\\n, [%[out], #(16 * \\n)]\n"
+        ".endr\n"
+        : [spin] "+r"(spin)
+        : [pat] "r"(pat), [out] "r"(out)
+        : "x9", "cc", "memory",
+          "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",
+          "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",
+          "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",
+          "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31");
+}
+
+static void fpsimd_check_thread(void *arg) {
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+    unsigned int migrations = 0;
+    uint64_t out[32][2];
+
+    for (unsigned int round = 0; round < FPSIMD_CHECK_ROUNDS; round++) {
+        uint64_t pat = ((uint64_t)id << 48) | ((uint64_t)round << 32) | 0x5a5a0000;
+        unsigned int cpu = cpu_id();
+
+        fpsimd_check_round(pat, out);
+        migrations += cpu_id() != cpu;
+
+        for (unsigned int n = 0; n < 32; n++) {
+            if (out[n][0] != pat + n || out[n][1] != pat + n) {
+                LOG_ERROR("fpsimd: check %u round %u: v%u is 0x%lx%016lx, expected 0x%lx%016lx\n",
+                          id, round, n, out[n][1], out[n][0], pat + n, pat + n);
+                return;
+            }
+        }
+    }
+    LOG_INFO("fpsimd: check %u ok, %u rounds, %u of them ending on another CPU\n",
+             id, FPSIMD_CHECK_ROUNDS, migrations);
+
+    if (__atomic_add_fetch(&fpsimd_check_done, 1, __ATOMIC_ACQ_REL) == FPSIMD_CHECK_THREADS) {
+        fpsimd_dump();
+    }
+}
+
+void fpsimd_check_start(void) {
+    for (unsigned int i = 0; i < FPSIMD_CHECK_THREADS; i++) {
+        thread_create("fpcheck", fpsimd_check_thread, (void *)(uintptr_t)i);
+    }
+}
@@ -0,0 +1,139 @@
+#include <stddef.h>
+#include "arch/cpu.h"
+#include "arch/exception.h"
+#include "arch/irq.h"
+#include "drivers/gic.h"
+#include "lib/printk.h"
+#include "lib/rcu.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
+#include "sched/sched.h"
+
+// Handlers live in a flat table indexed by INTID, so dispatch is one
+// bounds check and one indexed indirect call. Unclaimed slots point at
+// irq_unexpected() rather than NULL, which keeps the check off the hot
+// path. Counts are kept per CPU so the increment never bounces a line.
+//
+// Each slot is published RCU-style: irq_handle() runs with IRQs masked,
+// which makes it a read-side section, and takes one consistent snapshot
+// of the descriptor. irq_unregister() waits for a grace period, so once
+// it returns no CPU is still inside the old handler.
+
+struct irq_desc {
+    irq_handler_t handler;
+    void *arg;
+};
+
+static void irq_unexpected(unsigned int irq, void *arg);
+
+static const struct irq_desc irq_desc_none = { irq_unexpected, NULL };
+static struct irq_desc irq_desc_pool[GIC_MAX_IRQS];
+static const struct irq_desc *irq_desc[GIC_MAX_IRQS] = {
+    [0 ... GIC_MAX_IRQS - 1] = &irq_desc_none,
+};
+static spinlock_t irq_desc_lock = SPINLOCK_INIT;
+
+static unsigned int irq_counts[MAX_CPUS][GIC_MAX_IRQS];
+static struct exception_frame *irq_frames[MAX_CPUS];   // while in a handler
+
+static void irq_unexpected(unsigned int irq, void *arg) {
+    (void)arg;
+    LOG_WARN("irq: unexpected IRQ %u on cpu%u, masking it\n", irq, cpu_id());
+    gic_disable_irq(irq);
+}
+
+int irq_register(unsigned int irq, irq_handler_t handler, void *arg) {
+    if (irq >= GIC_MAX_IRQS) {
+        LOG_ERROR("irq: IRQ %u out of range\n", irq);
+        return -1;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    if (irq_desc[irq] != &irq_desc_none) {
+        spin_unlock_irqrestore(&irq_desc_lock, flags);
+        LOG_ERROR("irq: IRQ %u already has a handler\n", irq);
+        return -1;
+    }
+
+    // The slot is unpublished, so no reader can see it being filled
+    irq_desc_pool[irq] = (struct irq_desc){ handler, arg };
+    rcu_assign_pointer(irq_desc[irq], &irq_desc_pool[irq]);
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+
+    gic_enable_irq(irq);
+    return 0;
+}
+
+void irq_unregister(unsigned int irq) {
+    if (irq >= GIC_MAX_IRQS) {
+        return;
+    }
+
+    gic_disable_irq(irq);
+
+    unsigned long flags = spin_lock_irqsave(&irq_desc_lock);
+    rcu_assign_pointer(irq_desc[irq], &irq_desc_none);
+    spin_unlock_irqrestore(&irq_desc_lock, flags);
+
+    // A CPU that took the IRQ just before may still be in the handler
+    synchronize_rcu();
+}
+
+void irq_handle(struct exception_frame *frame) {
+    unsigned int cpu = cpu_id();
+    unsigned int iar = gic_ack();
+    unsigned int irq = iar & GIC_IAR_ID_MASK;
+
+    if (irq >= GIC_MAX_IRQS) {
+        if (irq < GIC_SPURIOUS_IRQ) {
+            gic_eoi(iar);
+        }
+        return;
+    }
+
+    const struct irq_desc *desc = rcu_dereference(irq_desc[irq]);
+
+    irq_counts[cpu][irq]++;
+    stat_inc(STAT_IRQS);
+    irq_frames[cpu] = frame;
+    desc->handler(irq, desc->arg);
+    irq_frames[cpu] = NULL;
+
+    gic_eoi(iar);
+    sched_irq_exit();
+}
+
+struct exception_frame *irq_frame(void) {
+    return irq_frames[cpu_id()];
+}
+
+unsigned long irq_count(unsigned int irq) {
+    unsigned long total = 0;
+
+    if (irq >= GIC_MAX_IRQS) {
+        return 0;
+    }
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        total += __atomic_load_n(&irq_counts[cpu][irq], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+void irq_stats_dump(void) {
+    LOG_INFO("irq: per-CPU counts\n");
+    for (unsigned int irq = 0; irq < GIC_MAX_IRQS; irq++) {
+        if (!irq_count(irq)) {
+            continue;
+        }
+        // One record per row, so other CPUs' output cannot split it
+        char row[LOG_RECORD_MAX];
+        size_t len = (size_t)snprintk(row, sizeof(row), "        irq %3u:", irq);
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpu_data[cpu].online) {
+                len += (size_t)snprintk(row + len, sizeof(row) - len, " %8u",
+                                        irq_counts[cpu][irq]);
+            }
+        }
+        printk("%s\n", row);
+    }
+}
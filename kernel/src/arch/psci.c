@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/psci.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+
+// PSCI calls follow the SMC Calling Convention: function ID in x0,
+// arguments in x1-x3, result in x0. Firmware may clobber x4-x17.
+
+enum psci_conduit {
+    PSCI_CONDUIT_NONE,
+    PSCI_CONDUIT_HVC,
+    PSCI_CONDUIT_SMC,
+};
+
+static enum psci_conduit psci_conduit;
+static uint32_t psci_cpu_on_fn = PSCI_CPU_ON_64;
+
+static uint64_t psci_call(uint64_t fn, uint64_t a1, uint64_t a2, uint64_t a3) {
+    register uint64_t x0 __asm__("x0") = fn;
+    register uint64_t x1 __asm__("x1") = a1;
+    register uint64_t x2 __asm__("x2") = a2;
+    register uint64_t x3 __asm__("x3") = a3;
+
+    if (psci_conduit == PSCI_CONDUIT_HVC) {
+        __asm__ volatile("hvc #0"
+                         : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                         :
+                         : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                           "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    } else {
+        __asm__ volatile("smc #0"
+                         : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                         :
+                         : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                           "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    }
+    return x0;
+}
+
+static bool method_is(const char *method, const char *name) {
+    while (*name && *method == *name) {
+        method++;
+        name++;
+    }
+    return *method == *name;
+}
+
+int psci_init(void) {
+    int node = fdt_find_compatible(-1, "arm,psci-0.2");
+    bool v02 = node >= 0;
+
+    if (!v02) {
+        node = fdt_find_compatible(-1, "arm,psci");
+    }
+    if (node < 0) {
+        return -1;
+    }
+
+    const char *method = fdt_getprop(fdt_blob(), node, "method", NULL);
+    if (method && method_is(method, "hvc")) {
+        psci_conduit = PSCI_CONDUIT_HVC;
+    } else if (method && method_is(method, "smc")) {
+        psci_conduit = PSCI_CONDUIT_SMC;
+    } else {
+        LOG_WARN("psci: unknown conduit\n");
+        return -1;
+    }
+
+    // PSCI 0.1 has no fixed function IDs; the node lists them.
+    const uint32_t *fn = fdt_getprop(fdt_blob(), node, "cpu_on", NULL);
+    if (fn) {
+        psci_cpu_on_fn = fdt32_to_cpu(*fn);
+    } else if (!v02) {
+        LOG_WARN("psci: v0.1 without a cpu_on function ID\n");
+        psci_conduit = PSCI_CONDUIT_NONE;
+        return -1;
+    }
+
+    const char *conduit = (psci_conduit == PSCI_CONDUIT_HVC) ? "hvc" : "smc";
+    if (v02) {
+        uint32_t version = (uint32_t)psci_call(PSCI_VERSION, 0, 0, 0);
+        LOG_INFO("psci: v%u.%u via %s\n", version >> 16, version & 0xFFFF, conduit);
+    } else {
+        LOG_INFO("psci: v0.1 via %s\n", conduit);
+    }
+    return 0;
+}
+
+int psci_cpu_on(uint64_t mpidr, uintptr_t entry, uintptr_t context) {
+    if (psci_conduit == PSCI_CONDUIT_NONE) {
+        return PSCI_NOT_SUPPORTED;
+    }
+    return (int)psci_call(psci_cpu_on_fn, mpidr, entry, context);
+}
+
+void psci_system_off(void) {
+    if (psci_conduit != PSCI_CONDUIT_NONE) {
+        psci_call(PSCI_SYSTEM_OFF, 0, 0, 0);
+    }
+}
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include "arch/cache.h"
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "arch/psci.h"
+#include "arch/smp.h"
+#include "arch/sysreg.h"
+#include "drivers/gic.h"
+#include "drivers/timer.h"
+#include "lib/fdt.h"
+#include "lib/log.h"
+#include "lib/printk.h"
+#include "profile/profile.h"
+#include "sched/sched.h"
+
+// Secondary core bring-up.
+//
+// The boot CPU walks /cpus, fills in a cpu_data entry per core and asks
+// firmware to start it at secondary_entry (boot.S) with &cpu_data[n] as
+// the PSCI context ID. The new core arrives with its MMU and caches off,
+// so that entry is cleaned to memory first; from it the core takes its
+// stack, points TPIDR_EL1 at it and joins the shared page tables.
+//
+// linker.ld reserves one KERNEL_STACK_SIZE stack per CPU in .stack:
+//
+//   __stack_bottom  __stack_top
+//   |   CPU 0      |   CPU 1      |   ...     |   CPU n-1   |
+//                                                    __stacks_end
+
+#define CPU_ON_TIMEOUT_NS (100 * NSEC_PER_MSEC)    // for a core to report in
+
+struct cpu_data cpu_data[MAX_CPUS];
+static unsigned int nr_cpus = 1;       // online
+static unsigned int next_cpu = 1;      // next cpu_data slot and stack
+
+extern char __stack_bottom[], __stack_top[], __stacks_end[];
+extern char secondary_entry[];
+
+static bool wait_online(const struct cpu_data *cpu) {
+    uint64_t deadline = ktime_ns() + CPU_ON_TIMEOUT_NS;
+
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (ktime_ns() > deadline) {
+            return false;
+        }
+        cpu_relax();
+    }
+    return true;
+}
+
+static void cpu_start(uint64_t mpidr, size_t stack_size) {
+    struct cpu_data *cpu = &cpu_data[next_cpu];
+
+    cpu->id = next_cpu;
+    cpu->mpidr = mpidr;
+    cpu->stack_top = (uintptr_t)__stack_top + next_cpu * stack_size;
+    cpu->online = 0;
+    dcache_clean_range(cpu, sizeof(*cpu));
+
+    int ret = psci_cpu_on(mpidr, (uintptr_t)secondary_entry, (uintptr_t)cpu);
+    if (ret != PSCI_SUCCESS) {
+        LOG_WARN("smp: CPU_ON 0x%lx failed (%d)\n", mpidr, ret);
+        return;     // never started: the slot can be reused
+    }
+
+    // The core may still turn up later, with this slot and stack. Retire
+    // them either way, so a late starter cannot share them with the next
+    // core; it then simply comes online late.
+    next_cpu++;
+    if (!wait_online(cpu)) {
+        LOG_WARN("smp: CPU 0x%lx did not come up\n", mpidr);
+        return;
+    }
+    nr_cpus++;
+}
+
+void smp_init(void) {
+    struct cpu_data *boot = &cpu_data[0];
+    uint64_t self = read_sysreg(mpidr_el1) & MPIDR_AFF_MASK;
+
+    boot->mpidr = self;
+    boot->stack_top = (uintptr_t)__stack_top;
+    boot->online = 1;
+
+    int cpus = fdt_find_node("/cpus");
+    if (cpus < 0 || psci_init() < 0) {
+        LOG_INFO("smp: no PSCI or /cpus, running on one CPU\n");
+        return;
+    }
+
+    size_t stack_size = (size_t)(__stack_top - __stack_bottom);
+    size_t nr_stacks = (size_t)(__stacks_end - __stack_bottom) / stack_size;
+
+    for (int node = fdt_next_child(cpus, -1); node >= 0; node = fdt_next_child(cpus, node)) {
+        uint64_t mpidr, size;
+
+        // cpu@N nodes carry the MPIDR in "reg"; cpu-map and friends do not
+        if (!fdt_get_reg(node, 0, &mpidr, &size) || mpidr == self) {
+            continue;
+        }
+        if (next_cpu == MAX_CPUS || next_cpu == nr_stacks) {
+            LOG_WARN("smp: only %u CPUs supported\n", next_cpu);
+            break;
+        }
+        cpu_start(mpidr, stack_size);
+    }
+
+    LOG_INFO("smp: %u CPUs online\n", nr_cpus);
+}
+
+unsigned int smp_cpu_count(void) {
+    return nr_cpus;
+}
+
+// Called from secondary_entry once the MMU is on
+void secondary_main(struct cpu_data *cpu) {
+    gic_cpu_init();
+    timer_cpu_init();
+    profile_cpu_init();
+    sched_cpu_init();
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    local_irq_enable();
+    cpu_idle();
+}
+
+// The idle thread: format pending deferred log records, sleep until an
+// interrupt unless there is work (here or on a queue worth stealing
+// from), then let the scheduler pick. IRQs are masked around the check so
+// a wakeup cannot slip in between it and the WFI; WFI still wakes on a
+// pending interrupt while masked.
+void cpu_idle(void) {
+    for (;;) {
+        log_drain();
+
+        unsigned long flags = local_irq_save();
+        if (!sched_work_pending()) {
+            wfi();
+        }
+        local_irq_restore(flags);
+
+        schedule();
+    }
+}
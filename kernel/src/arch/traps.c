@@ -0,0 +1,48 @@
+#include "arch/exception.h"
+#include "arch/fpsimd.h"
+#include "arch/sysreg.h"
+#include "drivers/uart.h"
+#include "lib/log.h"
+#include "lib/printk.h"
+
+static const char *const exception_names[] = {
+    "Sync (EL1t)",   "IRQ (EL1t)",   "FIQ (EL1t)",   "SError (EL1t)",
+    "Sync (EL1h)",   "IRQ (EL1h)",   "FIQ (EL1h)",   "SError (EL1h)",
+    "Sync (EL0/64)", "IRQ (EL0/64)", "FIQ (EL0/64)", "SError (EL0/64)",
+    "Sync (EL0/32)", "IRQ (EL0/32)", "FIQ (EL0/32)", "SError (EL0/32)",
+};
+
+void exception_unhandled(struct exception_frame *frame, unsigned int type) {
+    // The TX ring may never drain again from here on, and the CPU that
+    // holds the log drainer may be the one that faulted: print synchronously.
+    uart_force_polled();
+    log_panic();
+
+    LOG_ERROR("Unhandled exception: %s\n",
+              type < 16 ? exception_names[type] : "unknown");
+    LOG_ERROR("ESR=0x%016lx ELR=0x%016lx FAR=0x%016lx SPSR=0x%016lx\n",
+              read_sysreg(esr_el1), frame->elr, read_sysreg(far_el1), frame->spsr);
+
+    for (int i = 0; i < 31; i++) {
+        printk("x%d%s=0x%016lx%s", i, i < 10 ? " " : "", frame->regs[i],
+               (i % 4 == 3 || i == 30) ? "\n" : "  ");
+    }
+
+    while (1) {
+        wfe();
+    }
+}
+
+#define ESR_EC_SHIFT  26
+#define ESR_EC_FP_ACC 0x07      // FP/SIMD access trapped by CPACR_EL1
+
+void handle_sync(struct exception_frame *frame) {
+    unsigned int ec = (read_sysreg(esr_el1) >> ESR_EC_SHIFT) & 0x3F;
+
+    // ELR points at the trapped instruction, which simply runs again
+    if (ec == ESR_EC_FP_ACC) {
+        fpsimd_trap();
+        return;
+    }
+    exception_unhandled(frame, EXC_SYNC_EL1H);
+}
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/sysreg.h"
+#include "bench/bench.h"
+#include "drivers/timer.h"
+#include "lib/printk.h"
+
+// Benchmark runner. Each iteration is timed on its own, so a single slow
+// one (an IRQ, a refill, a cache miss) shows up in p99 and leaves min and
+// the median alone.
+//
+// The clock is the PMU cycle counter when the CPU has a PMU, otherwise
+// the generic timer, whose 16 ns tick on QEMU virt is too coarse for the
+// short cases. Under TCG "cycles" are emulated time, not host cycles:
+// compare runs with each other, not with hardware numbers.
+//
+// The cost of reading the clock twice is measured first with an empty
+// case and subtracted from every sample.
+
+#define ID_AA64DFR0_PMUVER(x) (((x) >> 8) & 0xF)
+#define PMUVER_IMPDEF         0xF
+
+#define PMCR_E      (1UL << 0)  // enable counters
+#define PMCR_C      (1UL << 2)  // reset the cycle counter
+#define PMCR_LC     (1UL << 6)  // 64-bit cycle counter overflow
+#define PMCNTEN_C   (1UL << 31)
+
+extern const struct bench_case __bench_start[];
+extern const struct bench_case __bench_end[];
+
+static bool bench_use_pmu;
+static uint64_t bench_overhead;
+static uint64_t samples[BENCH_ITERS];
+
+static bool pmu_init(void) {
+    uint64_t ver = ID_AA64DFR0_PMUVER(read_sysreg(id_aa64dfr0_el1));
+
+    if (ver == 0 || ver == PMUVER_IMPDEF) {
+        return false;
+    }
+    write_sysreg(pmccfiltr_el0, 0);     // count at EL0 and EL1
+    write_sysreg(pmcntenset_el0, PMCNTEN_C);
+    write_sysreg(pmcr_el0, read_sysreg(pmcr_el0) | PMCR_E | PMCR_C | PMCR_LC);
+    isb();
+    return true;
+}
+
+static inline uint64_t bench_now(void) {
+    if (bench_use_pmu) {
+        isb();
+        return read_sysreg(pmccntr_el0);
+    }
+    return timer_cycles();
+}
+
+static void bench_empty(void) {
+}
+
+static void sort_samples(uint64_t *v, unsigned int n) {
+    for (unsigned int i = 1; i < n; i++) {
+        uint64_t x = v[i];
+        unsigned int j = i;
+
+        while (j > 0 && v[j - 1] > x) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+// Time BENCH_ITERS iterations of fn into samples[], sorted
+static void bench_sample(void (*fn)(void)) {
+    for (unsigned int i = 0; i < BENCH_WARMUP; i++) {
+        fn();
+    }
+    for (unsigned int i = 0; i < BENCH_ITERS; i++) {
+        uint64_t start = bench_now();
+        fn();
+        uint64_t delta = bench_now() - start;
+
+        samples[i] = delta > bench_overhead ? delta - bench_overhead : 0;
+    }
+    sort_samples(samples, BENCH_ITERS);
+}
+
+static uint64_t to_unit(uint64_t v) {
+    return bench_use_pmu ? v : timer_cycles_to_ns(v);
+}
+
+static void bench_report(const char *name) {
+    printk("bench: %s n=%u min=%lu med=%lu p99=%lu %s\n", name, BENCH_ITERS,
+           to_unit(samples[0]), to_unit(samples[BENCH_ITERS / 2]),
+           to_unit(samples[BENCH_ITERS * 99 / 100]),
+           bench_use_pmu ? "cycles" : "ns");
+    log_drain();
+}
+
+void bench_run_all(void) {
+    bench_use_pmu = pmu_init();
+
+    bench_overhead = 0;
+    bench_sample(bench_empty);
+    bench_overhead = samples[0];
+
+    LOG_INFO("bench: %lu cases, clock %s, overhead %lu subtracted\n",
+             (unsigned long)(__bench_end - __bench_start),
+             bench_use_pmu ? "PMCCNTR_EL0" : "CNTVCT_EL0", to_unit(bench_overhead));
+    log_drain();
+
+    for (const struct bench_case *b = __bench_start; b < __bench_end; b++) {
+        if (b->setup) {
+            b->setup();
+        }
+        bench_sample(b->fn);
+        bench_report(b->name);
+    }
+}
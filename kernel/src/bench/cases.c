@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include "bench/bench.h"
+#include "drivers/uart.h"
+#include "lib/printk.h"
+#include "lib/string.h"
+#include "mm/page_alloc.h"
+#include "mm/slab.h"
+
+// The starting set. Buffers are static so the cases measure the code, not
+// a page fault or an allocation; each one is touched by the warmup first.
+
+static char fmt_buf[128];
+static char dump_buf[1024];
+static uint8_t src[4096] __attribute__((aligned(64)));
+static uint8_t dst[4096] __attribute__((aligned(64)));
+
+// printk formatting, without the log ring and the UART behind it
+
+BENCH(snprintk_str) {
+    bench_keep(snprintk(fmt_buf, sizeof(fmt_buf), "%s: %s", "bench", "string"));
+}
+
+BENCH(snprintk_int) {
+    bench_keep(snprintk(fmt_buf, sizeof(fmt_buf), "%d %u %lu",
+                        -123456, 4000000000U, 18446744073709551615UL));
+}
+
+BENCH(snprintk_hex) {
+    bench_keep(snprintk(fmt_buf, sizeof(fmt_buf), "%x %08lx %p",
+                        0xdeadbeef, 0x40000000UL, (void *)fmt_buf));
+}
+
+BENCH(snprintk_mixed) {
+    bench_keep(snprintk(fmt_buf, sizeof(fmt_buf), "[%3u] %-8s %5d 0x%04x %c",
+                        7U, "cpu", -42, 0xbeef, 'x'));
+}
+
+// The same format, compiled once and replayed (make PRINTK_COMPILED=1)
+BENCH(snprintk_mixed_compiled) {
+    static struct printk_fmt pf = PRINTK_FMT_INIT("[%3u] %-8s %5d 0x%04x %c");
+
+    bench_keep(snprintk_fmt(fmt_buf, sizeof(fmt_buf), &pf, 7U, "cpu", -42, 0xbeef, 'x'));
+}
+
+// A NUL leaves no mark on the terminal. In IRQ mode this is the ring
+// enqueue; once the ring is full it includes waiting for the FIFO.
+BENCH(uart_putc) {
+    uart_putc('\0');
+}
+
+BENCH(hex_dump_256) {
+    bench_keep(hex_dump_to(dump_buf, sizeof(dump_buf), src, 256));
+}
+
+BENCH(memset_64) {
+    memset(dst, 0x5A, 64);
+    bench_keep(dst);
+}
+
+BENCH(memset_4k) {
+    memset(dst, 0, sizeof(dst));
+    bench_keep(dst);
+}
+
+BENCH(memcpy_64) {
+    memcpy(dst, src, 64);
+    bench_keep(dst);
+}
+
+BENCH(memcpy_4k) {
+    memcpy(dst, src, sizeof(dst));
+    bench_keep(dst);
+}
+
+BENCH(memcpy_4k_unaligned) {
+    memcpy(dst + 1, src + 3, sizeof(dst) - 4);
+    bench_keep(dst);
+}
+
+// Allocators: an alloc/free pair, so every iteration starts from the same
+// state and the fast paths (hot page cache, slab magazine) are measured.
+
+BENCH(alloc_page_free) {
+    free_page(alloc_page());
+}
+
+BENCH(alloc_pages_o3_free) {
+    free_pages(alloc_pages(3), 3);
+}
+
+static struct kmem_cache *bench_cache;
+
+static void bench_cache_setup(void) {
+    if (!bench_cache) {
+        bench_cache = kmem_cache_create("bench64", 64, 0);
+    }
+}
+
+BENCH_SETUP(kmem_cache_alloc_free, bench_cache_setup) {
+    kmem_cache_free(bench_cache, kmem_cache_alloc(bench_cache));
+}
@@ -0,0 +1,315 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/sysreg.h"
+#include "drivers/gic.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+
+// GICv2 and GICv3, found through the DTB.
+//
+// Both have a distributor (GICD) routing the shared peripheral interrupts
+// (SPIs, INTID 32+). The private ones (SGIs 0-15, PPIs 16-31) live in a
+// per-CPU block: a banked part of the GICD on v2, a redistributor (GICR)
+// frame per core on v3. The CPU interface is memory-mapped on v2 (GICC)
+// and a set of ICC_* system registers on v3.
+
+// QEMU virt defaults, used when the DTB has no GIC node
+#define GICD_BASE_DEFAULT 0x08000000UL
+#define GICC_BASE_DEFAULT 0x08010000UL
+
+#define GICD_REG(off) (*(volatile uint32_t *)(gicd_base + (off)))
+#define GICC_REG(off) (*(volatile uint32_t *)(gicc_base + (off)))
+
+#define GICD_CTLR          GICD_REG(0x000)
+#define GICD_TYPER         GICD_REG(0x004)
+#define GICD_IGROUPR(n)    GICD_REG(0x080 + 4 * (n))
+#define GICD_ISENABLER(n)  GICD_REG(0x100 + 4 * (n))
+#define GICD_ICENABLER(n)  GICD_REG(0x180 + 4 * (n))
+#define GICD_IPRIORITYR(n) GICD_REG(0x400 + 4 * (n))
+#define GICD_ITARGETSR(n)  GICD_REG(0x800 + 4 * (n))
+#define GICD_SGIR          GICD_REG(0xF00)
+#define GICD_IROUTER(n)    (*(volatile uint64_t *)(gicd_base + 0x6000 + 8 * (n)))
+
+#define GICD_CTLR_ENABLE_G0  (1U << 0)
+#define GICD_CTLR_ENABLE_G1  (1U << 1)
+#define GICD_CTLR_ARE        (1U << 4)
+#define GICD_CTLR_RWP        (1U << 31)
+
+#define GICC_CTLR GICC_REG(0x000)
+#define GICC_PMR  GICC_REG(0x004)
+#define GICC_IAR  GICC_REG(0x00C)
+#define GICC_EOIR GICC_REG(0x010)
+
+// v3 redistributor: an RD frame, then an SGI frame with the PPI/SGI
+// registers at the distributor's offsets
+#define GICR_FRAME_SIZE    0x20000UL
+#define GICR_SGI_OFFSET    0x10000UL
+#define GICR_CTLR          0x0000
+#define GICR_TYPER         0x0008
+#define GICR_WAKER         0x0014
+#define GICR_IGROUPR0      (GICR_SGI_OFFSET + 0x080)
+#define GICR_ISENABLER0    (GICR_SGI_OFFSET + 0x100)
+#define GICR_ICENABLER0    (GICR_SGI_OFFSET + 0x180)
+#define GICR_IPRIORITYR(n) (GICR_SGI_OFFSET + 0x400 + 4 * (n))
+
+#define GICR_CTLR_RWP            (1U << 3)
+#define GICR_TYPER_VLPIS         (1UL << 1)
+#define GICR_TYPER_LAST          (1UL << 4)
+#define GICR_WAKER_SLEEP         (1U << 1)
+#define GICR_WAKER_CHILDREN_ASLEEP (1U << 2)
+
+#define GICR_REG(cpu, off) (*(volatile uint32_t *)(gicr_base[cpu] + (off)))
+
+// v3 CPU interface registers, by encoding so any assembler takes them
+#define ICC_IAR1_EL1    S3_0_C12_C12_0
+#define ICC_EOIR1_EL1   S3_0_C12_C12_1
+#define ICC_PMR_EL1     S3_0_C4_C6_0
+#define ICC_BPR1_EL1    S3_0_C12_C12_3
+#define ICC_SRE_EL1     S3_0_C12_C12_5
+#define ICC_IGRPEN1_EL1 S3_0_C12_C12_7
+#define ICC_SGI1R_EL1   S3_0_C12_C11_5
+
+#define __read_icc(reg)       read_sysreg(reg)
+#define __write_icc(reg, val) write_sysreg(reg, val)
+#define read_icc(reg)         __read_icc(reg)
+#define write_icc(reg, val)   __write_icc(reg, val)
+
+#define GIC_PRIORITY_DEFAULT 0xA0A0A0A0U
+
+static unsigned int gic_version = 2;
+static unsigned int gic_lines;
+static uintptr_t gicd_base = GICD_BASE_DEFAULT;
+static uintptr_t gicc_base = GICC_BASE_DEFAULT;
+static uintptr_t gicr_region;
+static uintptr_t gicr_region_end;
+static uintptr_t gicr_base[MAX_CPUS];
+static uint8_t gic_cpu_mask[MAX_CPUS];     // v2 CPU interface bit, for SGIs
+
+static bool gic_probe(void) {
+    static const char *const v2_compat[] = {
+        "arm,gic-400", "arm,cortex-a15-gic", "arm,cortex-a9-gic",
+    };
+    uint64_t addr, size;
+    int node = fdt_find_compatible(-1, "arm,gic-v3");
+
+    if (node >= 0) {
+        if (!fdt_get_reg(node, 0, &addr, &size)) {
+            return false;
+        }
+        gicd_base = (uintptr_t)addr;
+        if (!fdt_get_reg(node, 1, &addr, &size)) {
+            return false;
+        }
+        gicr_region = (uintptr_t)addr;
+        gicr_region_end = (uintptr_t)(addr + size);
+        gic_version = 3;
+        return true;
+    }
+
+    for (unsigned int i = 0; i < sizeof(v2_compat) / sizeof(v2_compat[0]); i++) {
+        node = fdt_find_compatible(-1, v2_compat[i]);
+        if (node >= 0) {
+            break;
+        }
+    }
+    if (node < 0 || !fdt_get_reg(node, 0, &addr, &size)) {
+        return false;
+    }
+    gicd_base = (uintptr_t)addr;
+    if (!fdt_get_reg(node, 1, &addr, &size)) {
+        return false;
+    }
+    gicc_base = (uintptr_t)addr;
+    return true;
+}
+
+static void gicd_wait_rwp(void) {
+    while (GICD_CTLR & GICD_CTLR_RWP) {
+        cpu_relax();
+    }
+}
+
+// MPIDR affinity packed the way GICR_TYPER[63:32] reports it
+static uint32_t mpidr_to_gicr_aff(uint64_t mpidr) {
+    return (uint32_t)(((mpidr >> 8) & 0xFF000000UL) | (mpidr & 0xFFFFFFUL));
+}
+
+static uint64_t mpidr_to_irouter(uint64_t mpidr) {
+    return mpidr & MPIDR_AFF_MASK;
+}
+
+void gic_init(void) {
+    if (!gic_probe()) {
+        LOG_WARN("gic: no usable DTB node, assuming GICv2 at 0x%lx\n", GICD_BASE_DEFAULT);
+        gic_version = 2;
+        gicd_base = GICD_BASE_DEFAULT;
+        gicc_base = GICC_BASE_DEFAULT;
+    }
+
+    gic_lines = ((GICD_TYPER & 0x1F) + 1) * 32;
+    if (gic_lines > GIC_MAX_IRQS) {
+        gic_lines = GIC_MAX_IRQS;
+    }
+
+    GICD_CTLR = 0;
+    if (gic_version == 3) {
+        gicd_wait_rwp();
+    }
+
+    // SPIs (32+) start masked, in group 1, at a common priority, routed
+    // to the boot CPU.
+    uint64_t boot_mpidr = read_sysreg(mpidr_el1);
+    for (unsigned int i = 32; i < gic_lines; i += 32) {
+        GICD_ICENABLER(i / 32) = 0xFFFFFFFFU;
+        GICD_IGROUPR(i / 32) = 0xFFFFFFFFU;
+    }
+    for (unsigned int i = 32; i < gic_lines; i += 4) {
+        GICD_IPRIORITYR(i / 4) = GIC_PRIORITY_DEFAULT;
+        if (gic_version == 2) {
+            GICD_ITARGETSR(i / 4) = 0x01010101U;
+        }
+    }
+    if (gic_version == 3) {
+        for (unsigned int i = 32; i < gic_lines; i++) {
+            GICD_IROUTER(i) = mpidr_to_irouter(boot_mpidr);
+        }
+        gicd_wait_rwp();
+        GICD_CTLR = GICD_CTLR_ARE | GICD_CTLR_ENABLE_G1 | GICD_CTLR_ENABLE_G0;
+        gicd_wait_rwp();
+    } else {
+        GICD_CTLR = 1;
+    }
+
+    LOG_INFO("gic: GICv%u, %u lines, GICD at 0x%lx\n", gic_version, gic_lines, gicd_base);
+
+    gic_cpu_init();
+}
+
+// Find and wake this core's redistributor frame
+static bool gicr_cpu_init(unsigned int cpu) {
+    uint32_t aff = mpidr_to_gicr_aff(read_sysreg(mpidr_el1));
+    uintptr_t frame = gicr_region;
+
+    while (frame < gicr_region_end) {
+        uint64_t typer = *(volatile uint64_t *)(frame + GICR_TYPER);
+
+        if ((uint32_t)(typer >> 32) == aff) {
+            gicr_base[cpu] = frame;
+            break;
+        }
+        if (typer & GICR_TYPER_LAST) {
+            break;
+        }
+        frame += (typer & GICR_TYPER_VLPIS) ? 2 * GICR_FRAME_SIZE : GICR_FRAME_SIZE;
+    }
+    if (!gicr_base[cpu]) {
+        return false;
+    }
+
+    GICR_REG(cpu, GICR_WAKER) &= ~GICR_WAKER_SLEEP;
+    while (GICR_REG(cpu, GICR_WAKER) & GICR_WAKER_CHILDREN_ASLEEP) {
+        cpu_relax();
+    }
+    return true;
+}
+
+// The private interrupts and the CPU interface are banked per core:
+// every CPU sets up its own.
+void gic_cpu_init(void) {
+    unsigned int cpu = cpu_id();
+
+    if (gic_version == 3) {
+        if (!gicr_cpu_init(cpu)) {
+            LOG_ERROR("gic: no redistributor for cpu%u\n", cpu);
+            return;
+        }
+        GICR_REG(cpu, GICR_ICENABLER0) = 0xFFFFFFFFU;
+        GICR_REG(cpu, GICR_IGROUPR0) = 0xFFFFFFFFU;
+        for (unsigned int i = 0; i < 32; i += 4) {
+            GICR_REG(cpu, GICR_IPRIORITYR(i / 4)) = GIC_PRIORITY_DEFAULT;
+        }
+        while (GICR_REG(cpu, GICR_CTLR) & GICR_CTLR_RWP) {
+            cpu_relax();
+        }
+
+        write_icc(ICC_SRE_EL1, read_icc(ICC_SRE_EL1) | 1);
+        isb();
+        write_icc(ICC_PMR_EL1, 0xFF);       // let every priority through
+        write_icc(ICC_BPR1_EL1, 0);
+        write_icc(ICC_IGRPEN1_EL1, 1);
+        isb();
+        return;
+    }
+
+    // The banked ITARGETSR0 reads back this core's own interface bit
+    gic_cpu_mask[cpu] = GICD_ITARGETSR(0) & 0xFF;
+    for (unsigned int i = 0; i < 32; i += 4) {
+        GICD_IPRIORITYR(i / 4) = GIC_PRIORITY_DEFAULT;
+    }
+    GICC_PMR = 0xFF;    // let every priority through
+    GICC_CTLR = 1;
+}
+
+unsigned int gic_max_irqs(void) {
+    return gic_lines;
+}
+
+// SGIs and PPIs are only enabled on the calling CPU
+void gic_enable_irq(unsigned int irq) {
+    if (gic_version == 3 && irq < 32) {
+        GICR_REG(cpu_id(), GICR_ISENABLER0) = 1U << irq;
+    } else {
+        GICD_ISENABLER(irq / 32) = 1U << (irq % 32);
+    }
+}
+
+void gic_disable_irq(unsigned int irq) {
+    if (gic_version == 3 && irq < 32) {
+        unsigned int cpu = cpu_id();
+
+        GICR_REG(cpu, GICR_ICENABLER0) = 1U << irq;
+        while (GICR_REG(cpu, GICR_CTLR) & GICR_CTLR_RWP) {
+            cpu_relax();
+        }
+    } else {
+        GICD_ICENABLER(irq / 32) = 1U << (irq % 32);
+        if (gic_version == 3) {
+            gicd_wait_rwp();
+        }
+    }
+}
+
+void gic_send_sgi(unsigned int cpu, unsigned int sgi) {
+    // Make this CPU's writes visible before the target takes the IRQ
+    dsb(ishst);
+
+    if (gic_version == 3) {
+        uint64_t mpidr = cpu_data[cpu].mpidr;
+        uint64_t val = (1UL << (mpidr & 0xF)) |
+                       (((mpidr >> 8) & 0xFF) << 16) |
+                       ((uint64_t)(sgi & 0xF) << 24) |
+                       (((mpidr >> 16) & 0xFF) << 32) |
+                       (((mpidr >> 32) & 0xFF) << 48);
+
+        write_icc(ICC_SGI1R_EL1, val);
+        isb();
+        return;
+    }
+    GICD_SGIR = ((uint32_t)gic_cpu_mask[cpu] << 16) | (sgi & 0xF);
+}
+
+unsigned int gic_ack(void) {
+    if (gic_version == 3) {
+        return (unsigned int)read_icc(ICC_IAR1_EL1);
+    }
+    return GICC_IAR;
+}
+
+void gic_eoi(unsigned int iar) {
+    if (gic_version == 3) {
+        write_icc(ICC_EOIR1_EL1, iar);
+        return;
+    }
+    GICC_EOIR = iar;
+}
@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include "arch/irq.h"
+#include "arch/sysreg.h"
+#include "drivers/gic.h"
+#include "drivers/timer.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+#include "lib/seqlock.h"
+
+// Cycles and nanoseconds are converted with a 32.32 fixed-point factor
+// computed once at boot:
+//
+//   ns     = (cycles * cyc2ns) >> 32     cyc2ns = (10^9 << 32) / freq
+//   cycles = (ns * ns2cyc) >> 32         ns2cyc = (freq << 32) / 10^9
+//
+// The product is taken in 128 bits (one MUL + UMULH), so it neither
+// overflows nor loses precision for any 64-bit input, and the hot path
+// has no division.
+//
+// The factors are relative to a base point (base_cyc, base_ns), so
+// timer_set_freq() can recalibrate without making ktime_ns() jump. The
+// four words are read together under a seqlock: readers never lock or
+// write, and simply retry in the rare case that a recalibration raced.
+
+#define TIMER_VIRT_IRQ     27   // PPI 11 on QEMU virt
+#define TIMER_DT_VIRT_IDX  2    // secure phys, phys, virt, hyp
+
+#define CNTV_CTL_ENABLE  (1 << 0)
+#define CNTV_CTL_IMASK   (1 << 1)
+
+struct clock_params {
+    uint64_t freq;
+    uint64_t cyc2ns;
+    uint64_t ns2cyc;
+    uint64_t base_cyc;
+    uint64_t base_ns;
+};
+
+static struct clock_params clock;
+static seqlock_t clock_lock = SEQLOCK_INIT;
+static unsigned int timer_irq = TIMER_VIRT_IRQ;
+static timer_handler_t timer_handler;
+
+static inline uint64_t mul_shr32(uint64_t a, uint64_t b) {
+    return (uint64_t)(((unsigned __int128)a * b) >> 32);
+}
+
+static void clock_read(struct clock_params *out) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&clock_lock);
+        *out = clock;
+    } while (read_seqretry(&clock_lock, seq));
+}
+
+static uint64_t cycles_to_ns(const struct clock_params *c, uint64_t cycles) {
+    if (cycles >= c->base_cyc) {
+        return c->base_ns + mul_shr32(cycles - c->base_cyc, c->cyc2ns);
+    }
+    return c->base_ns - mul_shr32(c->base_cyc - cycles, c->cyc2ns);
+}
+
+static uint64_t ns_to_cycles(const struct clock_params *c, uint64_t ns) {
+    if (ns >= c->base_ns) {
+        return c->base_cyc + mul_shr32(ns - c->base_ns, c->ns2cyc);
+    }
+    return c->base_cyc - mul_shr32(c->base_ns - ns, c->ns2cyc);
+}
+
+static void timer_irq_handler(unsigned int irq, void *arg) {
+    (void)irq;
+    (void)arg;
+
+    // The line is level-triggered: stop it before running the handler,
+    // which may re-arm.
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_IMASK);
+    isb();
+
+    if (timer_handler) {
+        timer_handler();
+    }
+}
+
+int timer_set_freq(uint64_t freq) {
+    // (freq << 32) below must not overflow
+    if (freq == 0 || freq > UINT32_MAX) {
+        return -1;
+    }
+
+    unsigned long flags = local_irq_save();
+    write_seqlock(&clock_lock);
+
+    // Rebase at the current instant, so time stays continuous
+    uint64_t now = read_sysreg(cntvct_el0);
+    clock.base_ns = clock.freq ? cycles_to_ns(&clock, now) : 0;
+    clock.base_cyc = clock.freq ? now : 0;
+    clock.freq = freq;
+    // The frequency fits 32 bits, so both fit 64-bit arithmetic
+    clock.cyc2ns = (NSEC_PER_SEC << 32) / freq;
+    clock.ns2cyc = (freq << 32) / NSEC_PER_SEC;
+
+    write_sequnlock(&clock_lock);
+    local_irq_restore(flags);
+    return 0;
+}
+
+void timer_init(void) {
+    uint64_t freq = read_sysreg(cntfrq_el0) & 0xFFFFFFFF;
+
+    int node = fdt_find_compatible(-1, "arm,armv8-timer");
+    if (node < 0) {
+        node = fdt_find_compatible(-1, "arm,armv7-timer");
+    }
+    if (node >= 0) {
+        int irq = fdt_get_irq(node, TIMER_DT_VIRT_IDX);
+        if (irq >= 0) {
+            timer_irq = (unsigned int)irq;
+        }
+
+        // Firmware that leaves CNTFRQ_EL0 unprogrammed says so here
+        const uint32_t *prop = fdt_getprop(fdt_blob(), node, "clock-frequency", NULL);
+        if (prop && fdt32_to_cpu(*prop)) {
+            freq = fdt32_to_cpu(*prop);
+        }
+    }
+    if (timer_set_freq(freq) < 0) {
+        LOG_ERROR("timer: unusable counter frequency %lu Hz\n", freq);
+    }
+
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_IMASK);
+    irq_register(timer_irq, timer_irq_handler, NULL);
+
+    LOG_INFO("timer: %lu Hz, virtual timer IRQ %u\n", freq, timer_irq);
+}
+
+void timer_cpu_init(void) {
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_IMASK);
+    gic_enable_irq(timer_irq);
+}
+
+uint64_t timer_freq(void) {
+    struct clock_params c;
+
+    clock_read(&c);
+    return c.freq;
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    struct clock_params c;
+
+    clock_read(&c);
+    return cycles_to_ns(&c, cycles);
+}
+
+uint64_t timer_ns_to_cycles(uint64_t ns) {
+    struct clock_params c;
+
+    clock_read(&c);
+    return ns_to_cycles(&c, ns);
+}
+
+uint64_t ktime_ns(void) {
+    struct clock_params c;
+
+    clock_read(&c);
+    return cycles_to_ns(&c, read_sysreg(cntvct_el0));
+}
+
+void timer_set_handler(timer_handler_t handler) {
+    timer_handler = handler;
+}
+
+void timer_arm(uint64_t deadline_ns) {
+    write_sysreg(cntv_cval_el0, timer_ns_to_cycles(deadline_ns));
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_ENABLE);
+    isb();
+}
+
+void timer_cancel(void) {
+    write_sysreg(cntv_ctl_el0, CNTV_CTL_IMASK);
+    isb();
+}
@@ -1,17 +1,345 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/irq.h"
 #include "drivers/uart.h"
+#include "lib/console.h"
+#include "lib/fdt.h"
+#include "lib/string.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
 
+// QEMU virt defaults, used until uart_init() has looked at the DTB
 #define UART0_BASE 0x09000000UL
+#define UART0_IRQ  33   // SPI 1
 
-#define UART_DR   (*(volatile unsigned int *)(UART0_BASE + 0x00))
-#define UART_FR   (*(volatile unsigned int *)(UART0_BASE + 0x18))
+#define UART_DR   (*(volatile unsigned int *)(uart_base + 0x00))
+#define UART_FR   (*(volatile unsigned int *)(uart_base + 0x18))
+#define UART_LCRH (*(volatile unsigned int *)(uart_base + 0x2C))
+#define UART_CR   (*(volatile unsigned int *)(uart_base + 0x30))
+#define UART_IFLS (*(volatile unsigned int *)(uart_base + 0x34))
+#define UART_IMSC (*(volatile unsigned int *)(uart_base + 0x38))
+#define UART_MIS  (*(volatile unsigned int *)(uart_base + 0x40))
+#define UART_ICR  (*(volatile unsigned int *)(uart_base + 0x44))
+#define UART_PERIPHID2 (*(volatile unsigned int *)(uart_base + 0xFE8))
+
+static uintptr_t uart_base = UART0_BASE;
+static unsigned int uart_irq_num = UART0_IRQ;
+
+#define UART_FR_BUSY (1 << 3)
+#define UART_FR_RXFE (1 << 4)
 #define UART_FR_TXFF (1 << 5)
+#define UART_FR_TXFE (1 << 7)
 
-void uart_putc(char c) {
-    while (UART_FR & UART_FR_TXFF) {
-        // Wait until the transmit FIFO is not full
+#define UART_LCRH_FEN   (1 << 4)
+#define UART_LCRH_WLEN8 (3 << 5)
+
+#define UART_CR_UARTEN (1 << 0)
+#define UART_CR_TXE    (1 << 8)
+#define UART_CR_RXE    (1 << 9)
+
+#define UART_IFLS_TX_1_4 (1 << 0)
+#define UART_IFLS_RX_1_2 (2 << 3)
+
+#define UART_INT_RX (1 << 4)    // RX FIFO reached its level
+#define UART_INT_TX (1 << 5)
+#define UART_INT_RT (1 << 6)    // receive timeout: data below the level sat idle
+#define UART_INT_OE (1 << 10)
+
+// Error flags that come with each byte read from UART_DR
+#define UART_DR_FE (1 << 8)     // framing
+#define UART_DR_PE (1 << 9)     // parity
+#define UART_DR_BE (1 << 10)    // break
+#define UART_DR_OE (1 << 11)    // overrun: the FIFO was full, bytes were lost
+
+// Power of two, so the free-running indices wrap with a mask.
+#define UART_TX_RING_SIZE 4096
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+
+static char tx_ring[UART_TX_RING_SIZE];
+static unsigned int tx_head;    // next slot to fill
+static unsigned int tx_tail;    // next byte to send
+static unsigned int uart_imsc;  // shadow of UART_IMSC
+static bool tx_irq_mode;
+static spinlock_t tx_lock = SPINLOCK_INIT;   // ring and IMSC shadow
+static void (*tx_refill)(void);             // called when the ring drains
+
+// Receive ring: the RX interrupt is the only producer and there is one
+// consumer, so head and tail need no lock, only acquire/release. The
+// consumer reads the bytes where the interrupt stored them.
+#define UART_RX_RING_SIZE 4096
+#define UART_RX_RING_MASK (UART_RX_RING_SIZE - 1)
+
+static char rx_ring[UART_RX_RING_SIZE];
+static unsigned int rx_head;    // written by the producer
+static unsigned int rx_tail;    // written by the consumer
+static bool rx_irq_mode;
+static void (*rx_notify)(void);
+static struct uart_rx_stats rx_stats;
+
+// 16 bytes on r1p4 and earlier, 32 from r1p5 (PeriphID2 revision >= 3).
+static size_t uart_fifo_depth = 16;
+
+static void uart_putc_polled(char c) {
+    if (UART_FR & UART_FR_TXFF) {
+        stat_inc(STAT_UART_TX_STALLS);
+        while (UART_FR & UART_FR_TXFF) {
+            // Wait until the transmit FIFO is not full
+        }
     }
 
     UART_DR = (unsigned int)c;
+    stat_inc(STAT_UART_TX_BYTES);
+}
+
+// Push up to len bytes into the TX FIFO without waiting and return how
+// many were taken. An empty FIFO is refilled in one burst after a single
+// flag-register read instead of one read per byte.
+static size_t uart_fifo_write(const char *s, size_t len) {
+    size_t n = 0;
+
+    if (UART_FR & UART_FR_TXFE) {
+        size_t burst = (len < uart_fifo_depth) ? len : uart_fifo_depth;
+        while (n < burst) {
+            UART_DR = (unsigned char)s[n++];
+        }
+    }
+
+    while (n < len && !(UART_FR & UART_FR_TXFF)) {
+        UART_DR = (unsigned char)s[n++];
+    }
+
+    stat_add(STAT_UART_TX_BYTES, n);
+    return n;
+}
+
+static void uart_write_polled(const char *s, size_t len) {
+    bool stalled = false;
+
+    while (len > 0) {
+        size_t n = uart_fifo_write(s, len);
+        s += n;
+        len -= n;
+        if (len && !stalled) {
+            stalled = true;
+            stat_inc(STAT_UART_TX_STALLS);
+        }
+    }
+}
+
+// Move queued bytes into the TX FIFO until it fills up, and keep the TX
+// interrupt armed only while there is something left to send.
+// Must be called with tx_lock held and IRQs masked.
+static void uart_tx_drain(void) {
+    while (tx_tail != tx_head) {
+        unsigned int off = tx_tail & UART_TX_RING_MASK;
+        size_t span = tx_head - tx_tail;
+        if (span > UART_TX_RING_SIZE - off) {
+            span = UART_TX_RING_SIZE - off;
+        }
+
+        size_t n = uart_fifo_write(&tx_ring[off], span);
+        tx_tail += n;
+        if (n < span) {
+            break;
+        }
+    }
+
+    unsigned int imsc = (tx_tail != tx_head) ? (uart_imsc | UART_INT_TX)
+                                             : (uart_imsc & ~UART_INT_TX);
+    if (imsc != uart_imsc) {
+        uart_imsc = imsc;
+        UART_IMSC = imsc;
+    }
+}
+
+// Empty the RX FIFO into the ring. Returns the number of bytes stored.
+// The only producer: called from the RX interrupt, or by the consumer
+// itself while receive is polled.
+static size_t uart_rx_fill(void) {
+    unsigned int head = rx_head;
+    unsigned int tail = __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE);
+    size_t stored = 0;
+
+    while (!(UART_FR & UART_FR_RXFE)) {
+        unsigned int dr = UART_DR;
+
+        if (dr & UART_DR_OE) {
+            rx_stats.overruns++;
+        }
+        if (dr & (UART_DR_FE | UART_DR_PE | UART_DR_BE)) {
+            rx_stats.errors++;
+            continue;
+        }
+        if (head - tail == UART_RX_RING_SIZE) {
+            rx_stats.dropped++;
+            continue;
+        }
+        rx_ring[head & UART_RX_RING_MASK] = (char)dr;
+        head++;
+        stored++;
+    }
+
+    rx_stats.received += stored;
+    __atomic_store_n(&rx_head, head, __ATOMIC_RELEASE);
+    return stored;
+}
+
+static void uart_irq(unsigned int irq, void *arg) {
+    (void)irq;
+    (void)arg;
+
+    unsigned int mis = UART_MIS;
+
+    if (mis & (UART_INT_RX | UART_INT_RT | UART_INT_OE)) {
+        UART_ICR = UART_INT_RX | UART_INT_RT | UART_INT_OE;
+        if (uart_rx_fill() && rx_notify) {
+            rx_notify();
+        }
+    }
+
+    if (mis & UART_INT_TX) {
+        UART_ICR = UART_INT_TX;
+        spin_lock(&tx_lock);
+        uart_tx_drain();
+        spin_unlock(&tx_lock);
+
+        if (tx_refill) {
+            tx_refill();
+        }
+    }
+}
+
+// Boot console: busy-waits on the FIFO. Replaced by uart_console, its
+// higher-priority twin, once uart_enable_irq() has the ring running.
+static struct console uart_early_console = {
+    .name = "pl011-polled",
+    .write = uart_write_polled,
+    .priority = CON_PRIO_UART_POLLED,
+    .flags = CON_TERMINAL | CON_PANIC,
+};
+
+// After uart_force_polled() uart_write() is polled again, so this one
+// stays usable after a panic
+static struct console uart_console = {
+    .name = "pl011",
+    .write = uart_write,
+    .room = uart_tx_room,
+    .priority = CON_PRIO_UART,
+    .flags = CON_TERMINAL | CON_PANIC,
+};
+
+void uart_init(void) {
+    int node = fdt_find_compatible(-1, "arm,pl011");
+    uint64_t base, size;
+
+    if (node >= 0 && fdt_get_reg(node, 0, &base, &size)) {
+        int irq = fdt_get_irq(node, 0);
+        uart_base = (uintptr_t)base;
+        if (irq >= 0) {
+            uart_irq_num = (unsigned int)irq;
+        }
+    }
+
+    // LCRH may only be changed while the UART is disabled and idle.
+    UART_CR = 0;
+    while (UART_FR & UART_FR_BUSY) {
+    }
+
+    UART_LCRH = UART_LCRH_FEN | UART_LCRH_WLEN8;
+    UART_IFLS = UART_IFLS_TX_1_4 | UART_IFLS_RX_1_2;
+    UART_IMSC = uart_imsc = 0;
+    UART_ICR = 0x7FF;
+    UART_CR = UART_CR_UARTEN | UART_CR_TXE | UART_CR_RXE;
+
+    if (((UART_PERIPHID2 >> 4) & 0xF) >= 3) {
+        uart_fifo_depth = 32;
+    }
+
+    console_register(&uart_early_console);
+}
+
+void uart_enable_irq(void) {
+    if (irq_register(uart_irq_num, uart_irq, NULL) != 0) {
+        return;
+    }
+    tx_irq_mode = true;
+
+    // Receive: the FIFO level catches bursts, the timeout the stragglers
+    // (32 bit periods without a new byte) below the level
+    unsigned long flags = spin_lock_irqsave(&tx_lock);
+    rx_irq_mode = true;
+    uart_imsc |= UART_INT_RX | UART_INT_RT | UART_INT_OE;
+    UART_IMSC = uart_imsc;
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    console_register(&uart_console);
+}
+
+void uart_putc(char c) {
+    if (!tx_irq_mode) {
+        uart_putc_polled(c);
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&tx_lock);
+
+    if (tx_head - tx_tail == UART_TX_RING_SIZE) {
+        // Ring full: make room the slow way rather than drop output.
+        stat_inc(STAT_UART_TX_STALLS);
+        uart_putc_polled(tx_ring[tx_tail & UART_TX_RING_MASK]);
+        tx_tail++;
+    }
+
+    tx_ring[tx_head & UART_TX_RING_MASK] = c;
+    tx_head++;
+
+    // While the TX interrupt is armed the handler will pick the byte up;
+    // otherwise the FIFO is idle and needs a kick.
+    if (!(uart_imsc & UART_INT_TX)) {
+        uart_tx_drain();
+    }
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void uart_write(const char* s, size_t len) {
+    if (!tx_irq_mode) {
+        uart_write_polled(s, len);
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&tx_lock);
+
+    for (size_t i = 0; i < len; i++) {
+        if (tx_head - tx_tail == UART_TX_RING_SIZE) {
+            stat_inc(STAT_UART_TX_STALLS);
+            while (tx_head - tx_tail == UART_TX_RING_SIZE) {
+                // Ring full: make room the slow way rather than drop output.
+                uart_tx_drain();
+            }
+        }
+        tx_ring[tx_head & UART_TX_RING_MASK] = s[i];
+        tx_head++;
+    }
+
+    if (!(uart_imsc & UART_INT_TX)) {
+        uart_tx_drain();
+    }
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+size_t uart_tx_room(void) {
+    if (!tx_irq_mode) {
+        return SIZE_MAX;
+    }
+    return UART_TX_RING_SIZE - (__atomic_load_n(&tx_head, __ATOMIC_RELAXED) -
+                                __atomic_load_n(&tx_tail, __ATOMIC_RELAXED));
+}
+
+void uart_set_tx_refill(void (*refill)(void)) {
+    tx_refill = refill;
 }
 
 void uart_puts(const char* s) {
@@ -22,3 +350,88 @@ void uart_puts(const char* s) {
         uart_putc(*s++);
     }
 }
+
+void uart_flush(void) {
+    unsigned long flags = spin_lock_irqsave(&tx_lock);
+
+    do {
+        uart_tx_drain();
+    } while (tx_tail != tx_head);
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void uart_force_polled(void) {
+    local_irq_disable();
+
+    // The fault may have hit while this CPU held tx_lock: waiting for it
+    // would hang the panic path, so the ring is only flushed if the lock
+    // is free and dropped otherwise
+    if (spin_trylock(&tx_lock)) {
+        do {
+            uart_tx_drain();
+        } while (tx_tail != tx_head);
+        spin_unlock(&tx_lock);
+    } else {
+        tx_tail = tx_head;
+    }
+    tx_irq_mode = false;
+    rx_irq_mode = false;
+}
+
+size_t uart_rx_peek(const char **data) {
+    if (!rx_irq_mode) {
+        uart_rx_fill();
+    }
+
+    unsigned int tail = rx_tail;
+    unsigned int head = __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE);
+    unsigned int off = tail & UART_RX_RING_MASK;
+    size_t span = head - tail;
+
+    if (span > UART_RX_RING_SIZE - off) {
+        span = UART_RX_RING_SIZE - off;
+    }
+    *data = &rx_ring[off];
+    return span;
+}
+
+void uart_rx_consume(size_t n) {
+    // Frees the slots for the producer once the reads above are done
+    __atomic_store_n(&rx_tail, rx_tail + (unsigned int)n, __ATOMIC_RELEASE);
+}
+
+size_t uart_rx_available(void) {
+    if (!rx_irq_mode) {
+        uart_rx_fill();
+    }
+    return __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) - rx_tail;
+}
+
+size_t uart_read(char *buf, size_t len) {
+    size_t copied = 0;
+
+    while (copied < len) {
+        const char *data;
+        size_t span = uart_rx_peek(&data);
+
+        if (span == 0) {
+            break;
+        }
+        if (span > len - copied) {
+            span = len - copied;
+        }
+        memcpy(buf + copied, data, span);
+        uart_rx_consume(span);
+        copied += span;
+    }
+    return copied;
+}
+
+void uart_set_rx_notify(void (*notify)(void)) {
+    rx_notify = notify;
+}
+
+void uart_rx_get_stats(struct uart_rx_stats *stats) {
+    *stats = rx_stats;
+}
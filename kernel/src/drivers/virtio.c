@@ -0,0 +1,332 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/sysreg.h"
+#include "drivers/virtio.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+#include "lib/string.h"
+#include "mm/memlayout.h"
+#include "mm/page_alloc.h"
+
+// QEMU virt transport slots, used without a DTB
+#define VIRTIO_MMIO_BASE   0x0a000000UL
+#define VIRTIO_MMIO_STRIDE 0x200
+#define VIRTIO_MMIO_IRQ    48   // SPI 16, one per slot
+
+#define VIRTIO_MAGIC 0x74726976 // "virt"
+
+// Register offsets. Legacy-only and modern-only ones are marked.
+#define VIRTIO_MMIO_MAGIC           0x000
+#define VIRTIO_MMIO_VERSION         0x004
+#define VIRTIO_MMIO_DEVICE_ID       0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_GUEST_PAGE_SIZE 0x028   // legacy
+#define VIRTIO_MMIO_QUEUE_SEL       0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX   0x034
+#define VIRTIO_MMIO_QUEUE_NUM       0x038
+#define VIRTIO_MMIO_QUEUE_ALIGN     0x03c   // legacy
+#define VIRTIO_MMIO_QUEUE_PFN       0x040   // legacy
+#define VIRTIO_MMIO_QUEUE_READY     0x044   // modern
+#define VIRTIO_MMIO_QUEUE_NOTIFY    0x050
+#define VIRTIO_MMIO_STATUS          0x070
+#define VIRTIO_MMIO_QUEUE_DESC      0x080   // modern, low/high pairs
+#define VIRTIO_MMIO_QUEUE_DRIVER    0x090
+#define VIRTIO_MMIO_QUEUE_DEVICE    0x0a0
+#define VIRTIO_MMIO_CONFIG_GEN      0x0fc   // modern
+#define VIRTIO_MMIO_CONFIG          0x100
+
+#define VIRTIO_STATUS_ACKNOWLEDGE (1 << 0)
+#define VIRTIO_STATUS_DRIVER      (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK   (1 << 2)
+#define VIRTIO_STATUS_FEATURES_OK (1 << 3)
+#define VIRTIO_STATUS_FAILED      (1 << 7)
+
+static struct virtio_dev virtio_devs[VIRTIO_MAX_DEVICES];
+static unsigned int nr_virtio_devs;
+
+static inline uint32_t virtio_read(struct virtio_dev *dev, unsigned int reg) {
+    return *(volatile uint32_t *)(dev->base + reg);
+}
+
+static inline void virtio_write(struct virtio_dev *dev, unsigned int reg, uint32_t val) {
+    *(volatile uint32_t *)(dev->base + reg) = val;
+}
+
+static inline void virtio_write64(struct virtio_dev *dev, unsigned int reg, uint64_t val) {
+    virtio_write(dev, reg, (uint32_t)val);
+    virtio_write(dev, reg + 4, (uint32_t)(val >> 32));
+}
+
+static void virtio_add(uintptr_t base, int irq) {
+    struct virtio_dev probe = { .base = base };
+
+    if (nr_virtio_devs == VIRTIO_MAX_DEVICES ||
+        virtio_read(&probe, VIRTIO_MMIO_MAGIC) != VIRTIO_MAGIC) {
+        return;
+    }
+    uint32_t version = virtio_read(&probe, VIRTIO_MMIO_VERSION);
+    uint32_t id = virtio_read(&probe, VIRTIO_MMIO_DEVICE_ID);
+    if (id == 0 || (version != 1 && version != 2)) {
+        return;     // empty slot
+    }
+
+    struct virtio_dev *dev = &virtio_devs[nr_virtio_devs++];
+    dev->base = base;
+    dev->irq = irq;
+    dev->device_id = id;
+    dev->version = version;
+}
+
+void virtio_init(void) {
+    int node = fdt_find_compatible(-1, "virtio,mmio");
+    uint64_t base, size;
+
+    if (node < 0) {
+        for (unsigned int i = 0; i < VIRTIO_MAX_DEVICES; i++) {
+            virtio_add(VIRTIO_MMIO_BASE + i * VIRTIO_MMIO_STRIDE, VIRTIO_MMIO_IRQ + (int)i);
+        }
+    }
+    for (; node >= 0; node = fdt_find_compatible(node, "virtio,mmio")) {
+        if (fdt_get_reg(node, 0, &base, &size)) {
+            virtio_add((uintptr_t)base, fdt_get_irq(node, 0));
+        }
+    }
+}
+
+struct virtio_dev *virtio_find(uint32_t device_id) {
+    for (unsigned int i = 0; i < nr_virtio_devs; i++) {
+        struct virtio_dev *dev = &virtio_devs[i];
+        if (dev->device_id == device_id && !dev->claimed) {
+            dev->claimed = true;
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+static void virtio_set_status(struct virtio_dev *dev, uint32_t bits) {
+    virtio_write(dev, VIRTIO_MMIO_STATUS, virtio_read(dev, VIRTIO_MMIO_STATUS) | bits);
+}
+
+bool virtio_negotiate(struct virtio_dev *dev, uint64_t wanted, uint64_t *accepted) {
+    bool modern = dev->version == 2;
+
+    // Writing 0 resets; a modern device reads 0 back once it is done
+    virtio_write(dev, VIRTIO_MMIO_STATUS, 0);
+    while (modern && virtio_read(dev, VIRTIO_MMIO_STATUS) != 0) {
+    }
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    virtio_set_status(dev, VIRTIO_STATUS_DRIVER);
+
+    // Legacy devices only have the low 32 feature bits
+    virtio_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 0);
+    uint64_t offered = virtio_read(dev, VIRTIO_MMIO_DEVICE_FEATURES);
+    if (modern) {
+        virtio_write(dev, VIRTIO_MMIO_DEVICE_FEATURES_SEL, 1);
+        offered |= (uint64_t)virtio_read(dev, VIRTIO_MMIO_DEVICE_FEATURES) << 32;
+        wanted |= 1ULL << VIRTIO_F_VERSION_1;
+    }
+
+    uint64_t features = offered & wanted;
+    virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 0);
+    virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)features);
+    if (modern) {
+        virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES_SEL, 1);
+        virtio_write(dev, VIRTIO_MMIO_DRIVER_FEATURES, (uint32_t)(features >> 32));
+
+        // The device may still refuse the combination
+        virtio_set_status(dev, VIRTIO_STATUS_FEATURES_OK);
+        if (!(features & (1ULL << VIRTIO_F_VERSION_1)) ||
+            !(virtio_read(dev, VIRTIO_MMIO_STATUS) & VIRTIO_STATUS_FEATURES_OK)) {
+            virtio_set_status(dev, VIRTIO_STATUS_FAILED);
+            return false;
+        }
+    }
+
+    if (accepted) {
+        *accepted = features;
+    }
+    return true;
+}
+
+// Legacy layout, which modern devices accept as well: descriptors, then
+// the available ring, then the used ring on the next page boundary.
+//
+//   | desc[num] | avail: flags idx ring[num] | pad | used: flags idx ring[num] |
+//                                                  ^ page aligned
+static size_t virtq_size(unsigned int num, size_t *used_offset) {
+    size_t avail_end = sizeof(struct virtq_desc) * num + sizeof(uint16_t) * (2 + num);
+    *used_offset = PAGE_ALIGN(avail_end);
+    return *used_offset + PAGE_ALIGN(sizeof(uint16_t) * 2 +
+                                     sizeof(struct virtq_used_elem) * num);
+}
+
+int virtq_init(struct virtq *vq, struct virtio_dev *dev, unsigned int index,
+               unsigned int max_num) {
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_SEL, index);
+    unsigned int num = virtio_read(dev, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (num > max_num) {
+        num = max_num;
+    }
+    if (num > VIRTQ_MAX_SIZE) {
+        num = VIRTQ_MAX_SIZE;
+    }
+    while (num & (num - 1)) {
+        num &= num - 1;     // round down to a power of two
+    }
+    if (num == 0) {
+        return -1;
+    }
+
+    size_t used_offset;
+    size_t size = virtq_size(num, &used_offset);
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < size) {
+        order++;
+    }
+    char *mem = alloc_pages_zeroed(order);
+    if (!mem) {
+        return -1;
+    }
+
+    memset(vq, 0, sizeof(*vq));
+    vq->dev = dev;
+    vq->index = index;
+    vq->num = num;
+    vq->desc = (struct virtq_desc *)mem;
+    vq->avail = (struct virtq_avail *)(mem + sizeof(struct virtq_desc) * num);
+    vq->used = (struct virtq_used *)(mem + used_offset);
+    vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    vq->num_free = (uint16_t)num;
+    for (unsigned int i = 0; i + 1 < num; i++) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+
+    virtio_write(dev, VIRTIO_MMIO_QUEUE_NUM, num);
+    if (dev->version == 1) {
+        virtio_write(dev, VIRTIO_MMIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+        virtio_write(dev, VIRTIO_MMIO_QUEUE_ALIGN, PAGE_SIZE);
+        virtio_write(dev, VIRTIO_MMIO_QUEUE_PFN, (uint32_t)((uintptr_t)mem >> PAGE_SHIFT));
+    } else {
+        virtio_write64(dev, VIRTIO_MMIO_QUEUE_DESC, (uintptr_t)vq->desc);
+        virtio_write64(dev, VIRTIO_MMIO_QUEUE_DRIVER, (uintptr_t)vq->avail);
+        virtio_write64(dev, VIRTIO_MMIO_QUEUE_DEVICE, (uintptr_t)vq->used);
+        virtio_write(dev, VIRTIO_MMIO_QUEUE_READY, 1);
+    }
+    return 0;
+}
+
+void virtio_driver_ok(struct virtio_dev *dev) {
+    virtio_set_status(dev, VIRTIO_STATUS_DRIVER_OK);
+}
+
+uint32_t virtio_config_read32(struct virtio_dev *dev, unsigned int offset) {
+    return virtio_read(dev, VIRTIO_MMIO_CONFIG + offset);
+}
+
+// Two 32-bit halves; a modern device bumps the generation if the value
+// changed in between. Legacy devices have no generation counter.
+uint64_t virtio_config_read64(struct virtio_dev *dev, unsigned int offset) {
+    uint32_t gen, lo, hi;
+
+    do {
+        gen = dev->version == 2 ? virtio_read(dev, VIRTIO_MMIO_CONFIG_GEN) : 0;
+        lo = virtio_read(dev, VIRTIO_MMIO_CONFIG + offset);
+        hi = virtio_read(dev, VIRTIO_MMIO_CONFIG + offset + 4);
+    } while (dev->version == 2 && gen != virtio_read(dev, VIRTIO_MMIO_CONFIG_GEN));
+    return (uint64_t)hi << 32 | lo;
+}
+
+int virtq_add(struct virtq *vq, const struct virtq_buf *bufs, unsigned int count,
+              void *cookie) {
+    if (count == 0 || count > vq->num_free) {
+        return -1;
+    }
+
+    uint16_t head = vq->free_head;
+    uint16_t i = head, last = head;
+    for (unsigned int n = 0; n < count; n++) {
+        struct virtq_desc *d = &vq->desc[i];
+        d->addr = (uintptr_t)bufs[n].addr;
+        d->len = bufs[n].len;
+        d->flags = (uint16_t)((bufs[n].write ? VIRTQ_DESC_F_WRITE : 0) |
+                              (n + 1 < count ? VIRTQ_DESC_F_NEXT : 0));
+        last = i;
+        i = d->next;
+    }
+    vq->free_head = vq->desc[last].next;
+    vq->num_free -= (uint16_t)count;
+    vq->cookie[head] = cookie;
+
+    // Visible to the device only once virtq_kick() moves avail->idx
+    vq->avail->ring[vq->avail_idx & (vq->num - 1)] = head;
+    vq->avail_idx++;
+    return head;
+}
+
+void virtq_kick(struct virtq *vq) {
+    if (vq->avail->idx == vq->avail_idx) {
+        return;
+    }
+
+    // Descriptors and ring entries before the index, the index before the
+    // flags check (the device may set NO_NOTIFY concurrently), all of it
+    // before the notify write to Device memory
+    __atomic_store_n(&vq->avail->idx, vq->avail_idx, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&vq->used->flags, __ATOMIC_RELAXED) & VIRTQ_USED_F_NO_NOTIFY) {
+        return;
+    }
+    dsb(st);
+    virtio_write(vq->dev, VIRTIO_MMIO_QUEUE_NOTIFY, vq->index);
+}
+
+void *virtq_get(struct virtq *vq, uint32_t *len) {
+    if (__atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE) == vq->last_used) {
+        return NULL;
+    }
+
+    struct virtq_used_elem *elem = &vq->used->ring[vq->last_used & (vq->num - 1)];
+    uint16_t head = (uint16_t)elem->id;
+    if (len) {
+        *len = elem->len;
+    }
+    vq->last_used++;
+
+    // Put the whole chain back on the free list
+    uint16_t i = head;
+    vq->num_free++;
+    while (vq->desc[i].flags & VIRTQ_DESC_F_NEXT) {
+        i = vq->desc[i].next;
+        vq->num_free++;
+    }
+    vq->desc[i].next = vq->free_head;
+    vq->free_head = head;
+
+    void *cookie = vq->cookie[head];
+    vq->cookie[head] = NULL;
+    return cookie;
+}
+
+static const char *virtio_name(uint32_t id) {
+    switch (id) {
+        case VIRTIO_ID_NET:     return "net";
+        case VIRTIO_ID_BLOCK:   return "blk";
+        case VIRTIO_ID_CONSOLE: return "console";
+        default:                return "?";
+    }
+}
+
+void virtio_dump(void) {
+    for (unsigned int i = 0; i < nr_virtio_devs; i++) {
+        struct virtio_dev *dev = &virtio_devs[i];
+        LOG_INFO("virtio: %s (id %u) at 0x%lx irq %d, %s%s\n",
+                 virtio_name(dev->device_id), dev->device_id, dev->base, dev->irq,
+                 dev->version == 2 ? "modern" : "legacy",
+                 dev->claimed ? "" : ", no driver");
+    }
+}
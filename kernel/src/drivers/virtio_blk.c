@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "drivers/virtio.h"
+#include "drivers/virtio_blk.h"
+#include "lib/printk.h"
+#include "lib/spinlock.h"
+
+#define VIRTIO_BLK_F_RO     5   // device is read-only
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+
+#define VIRTIO_BLK_S_OK     0
+
+// Sectors per request, which bounds the time spent with IRQs masked
+#define VBLK_MAX_SECTORS    128
+
+// A request is three descriptors: header (device reads), data, status
+// (device writes)
+struct virtio_blk_req {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+static struct virtio_dev *vblk_dev;
+static struct virtq vblk_q;
+static uint64_t vblk_capacity;
+static bool vblk_ro;
+
+// One request in flight; the lock covers the queue and these
+static struct virtio_blk_req vblk_hdr __attribute__((aligned(16)));
+static volatile uint8_t vblk_status;
+static spinlock_t vblk_lock = SPINLOCK_INIT;
+
+bool virtio_blk_init(void) {
+    struct virtio_dev *dev = virtio_find(VIRTIO_ID_BLOCK);
+    uint64_t features;
+
+    if (!dev || !virtio_negotiate(dev, 1ULL << VIRTIO_BLK_F_RO, &features)) {
+        return false;
+    }
+    if (virtq_init(&vblk_q, dev, 0, VIRTQ_MAX_SIZE) != 0 || vblk_q.num < 3) {
+        LOG_WARN("virtio: blk request queue unusable\n");
+        return false;
+    }
+    vblk_ro = features & (1ULL << VIRTIO_BLK_F_RO);
+    vblk_capacity = virtio_config_read64(dev, 0);
+    virtio_driver_ok(dev);
+    vblk_dev = dev;
+
+    LOG_INFO("virtio: blk %lu sectors (%lu KiB)%s\n", vblk_capacity,
+             vblk_capacity * VIRTIO_BLK_SECTOR_SIZE / 1024, vblk_ro ? ", read-only" : "");
+    return true;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return vblk_dev ? vblk_capacity : 0;
+}
+
+bool virtio_blk_read_only(void) {
+    return vblk_ro;
+}
+
+static int vblk_request(uint32_t type, uint64_t sector, void *buf, size_t count) {
+    struct virtq_buf bufs[3] = {
+        { &vblk_hdr, sizeof(vblk_hdr), false },
+        { buf, (uint32_t)(count * VIRTIO_BLK_SECTOR_SIZE), type == VIRTIO_BLK_T_IN },
+        { (const void *)&vblk_status, sizeof(vblk_status), true },
+    };
+
+    vblk_hdr.type = type;
+    vblk_hdr.reserved = 0;
+    vblk_hdr.sector = sector;
+    vblk_status = 0xFF;
+
+    if (virtq_add(&vblk_q, bufs, 3, &vblk_hdr) < 0) {
+        return -1;
+    }
+    virtq_kick(&vblk_q);
+    while (!virtq_get(&vblk_q, NULL)) {
+        cpu_relax();
+    }
+    return vblk_status == VIRTIO_BLK_S_OK ? 0 : -1;
+}
+
+static int vblk_transfer(uint32_t type, uint64_t sector, char *buf, size_t count) {
+    if (!vblk_dev || sector > vblk_capacity || count > vblk_capacity - sector) {
+        return -1;
+    }
+
+    while (count) {
+        size_t n = count < VBLK_MAX_SECTORS ? count : VBLK_MAX_SECTORS;
+        unsigned long flags = spin_lock_irqsave(&vblk_lock);
+        int ret = vblk_request(type, sector, buf, n);
+        spin_unlock_irqrestore(&vblk_lock, flags);
+        if (ret != 0) {
+            return -1;
+        }
+        sector += n;
+        buf += n * VIRTIO_BLK_SECTOR_SIZE;
+        count -= n;
+    }
+    return 0;
+}
+
+int virtio_blk_read(uint64_t sector, void *buf, size_t count) {
+    return vblk_transfer(VIRTIO_BLK_T_IN, sector, buf, count);
+}
+
+int virtio_blk_write(uint64_t sector, const void *buf, size_t count) {
+    if (vblk_ro) {
+        return -1;
+    }
+    return vblk_transfer(VIRTIO_BLK_T_OUT, sector, (char *)buf, count);
+}
@@ -0,0 +1,134 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "drivers/virtio.h"
+#include "drivers/virtio_console.h"
+#include "lib/console.h"
+#include "lib/printk.h"
+#include "lib/spinlock.h"
+#include "lib/string.h"
+
+// Port 0 without VIRTIO_CONSOLE_F_MULTIPORT: queue 0 receives, 1 transmits
+#define VCON_TXQ       1
+
+#define VCON_BUFS      16
+#define VCON_BUF_SIZE  1024
+
+struct vcon_buf {
+    char data[VCON_BUF_SIZE];
+};
+
+static struct virtio_dev *vcon_dev;
+static struct virtq vcon_txq;
+static struct vcon_buf vcon_bufs[VCON_BUFS] __attribute__((aligned(64)));
+static struct vcon_buf *vcon_free[VCON_BUFS];   // stack of idle buffers
+static unsigned int vcon_nfree;
+static struct vcon_buf *vcon_cur;               // being filled
+static size_t vcon_fill;
+static spinlock_t vcon_lock = SPINLOCK_INIT;
+
+static void vcon_reclaim(void) {
+    struct vcon_buf *buf;
+
+    while ((buf = virtq_get(&vcon_txq, NULL))) {
+        vcon_free[vcon_nfree++] = buf;
+    }
+}
+
+static struct vcon_buf *vcon_get_buf(void) {
+    vcon_reclaim();
+    if (!vcon_nfree) {
+        // Everything is queued: make sure the device knows, then wait
+        virtq_kick(&vcon_txq);
+        while (!vcon_nfree) {
+            cpu_relax();
+            vcon_reclaim();
+        }
+    }
+    return vcon_free[--vcon_nfree];
+}
+
+static void vcon_submit(void) {
+    struct virtq_buf out = { vcon_cur->data, (uint32_t)vcon_fill, false };
+
+    // Never fails: the queue has at least as many descriptors as buffers
+    virtq_add(&vcon_txq, &out, 1, vcon_cur);
+    vcon_cur = NULL;
+    vcon_fill = 0;
+}
+
+// Outranks the PL011, so the log moves here once the device is up
+static struct console vcon_console = {
+    .name = "virtio",
+    .write = virtio_console_write,
+    .flush = virtio_console_flush,
+    .priority = CON_PRIO_VIRTIO,
+    .flags = CON_TERMINAL,
+};
+
+bool virtio_console_init(void) {
+    struct virtio_dev *dev = virtio_find(VIRTIO_ID_CONSOLE);
+
+    if (!dev || !virtio_negotiate(dev, 0, NULL)) {
+        return false;
+    }
+    if (virtq_init(&vcon_txq, dev, VCON_TXQ, VIRTQ_MAX_SIZE) != 0 ||
+        vcon_txq.num < VCON_BUFS) {
+        LOG_WARN("virtio: console transmit queue unusable\n");
+        return false;
+    }
+    for (unsigned int i = 0; i < VCON_BUFS; i++) {
+        vcon_free[i] = &vcon_bufs[i];
+    }
+    vcon_nfree = VCON_BUFS;
+    virtio_driver_ok(dev);
+    __atomic_store_n(&vcon_dev, dev, __ATOMIC_RELEASE);
+    console_register(&vcon_console);
+    return true;
+}
+
+bool virtio_console_ready(void) {
+    return __atomic_load_n(&vcon_dev, __ATOMIC_ACQUIRE) != NULL;
+}
+
+void virtio_console_write(const char *buf, size_t len) {
+    if (!virtio_console_ready()) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&vcon_lock);
+
+    while (len) {
+        if (!vcon_cur) {
+            vcon_cur = vcon_get_buf();
+        }
+        size_t n = VCON_BUF_SIZE - vcon_fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(vcon_cur->data + vcon_fill, buf, n);
+        vcon_fill += n;
+        buf += n;
+        len -= n;
+        if (vcon_fill == VCON_BUF_SIZE) {
+            vcon_submit();
+        }
+    }
+    spin_unlock_irqrestore(&vcon_lock, flags);
+}
+
+void virtio_console_flush(void) {
+    if (!virtio_console_ready()) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&vcon_lock);
+
+    if (vcon_cur && vcon_fill) {
+        vcon_submit();
+    }
+    virtq_kick(&vcon_txq);
+    vcon_reclaim();
+    spin_unlock_irqrestore(&vcon_lock, flags);
+}
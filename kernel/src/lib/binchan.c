@@ -0,0 +1,122 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "drivers/uart.h"
+#include "lib/binchan.h"
+#include "lib/crc32.h"
+#include "lib/lz4.h"
+#include "lib/string.h"
+
+// Small writes are gathered into chunk[]; whole chunks of a large write
+// are compressed straight from the caller's buffer. The frame is
+// assembled in frame[]: header, then the compressed chunk (or a copy, if
+// LZ4 did not make it smaller), then the CRC. The buffers
+// are static and shared, so a single stream can be open at a time;
+// binchan_busy is the ownership flag.
+
+struct binchan_header {
+    uint8_t magic[4];
+    uint8_t type;
+    uint8_t flags;
+    uint16_t stream;
+    uint64_t offset;
+    uint32_t raw_len;
+    uint32_t wire_len;
+} __attribute__((packed));
+
+#define BINCHAN_HEADER_SIZE sizeof(struct binchan_header)
+#define BINCHAN_FRAME_MAX   (BINCHAN_HEADER_SIZE + LZ4_COMPRESS_BOUND(BINCHAN_CHUNK) + 4)
+
+_Static_assert(BINCHAN_CHUNK <= LZ4_MAX_INPUT, "chunk too big for lz4_compress()");
+
+static const uint8_t binchan_magic[4] = { 0x00, 0xA5, 'V', 'B' };
+
+static unsigned int binchan_busy;
+static uint16_t binchan_stream;
+static uint8_t binchan_type;
+static uint64_t binchan_offset;     // of the next frame
+static size_t chunk_len;
+static uint8_t chunk[BINCHAN_CHUNK];
+static uint8_t frame[BINCHAN_FRAME_MAX];
+
+static void binchan_send(const uint8_t *data, size_t raw_len, uint8_t flags) {
+    struct binchan_header *hdr = (struct binchan_header *)frame;
+    uint8_t *payload = frame + BINCHAN_HEADER_SIZE;
+    size_t wire_len = raw_len ? lz4_compress(data, raw_len, payload) : 0;
+
+    if (wire_len < raw_len) {
+        flags |= BINCHAN_F_LZ4;
+    } else {
+        memcpy(payload, data, raw_len);
+        wire_len = raw_len;
+    }
+
+    memcpy(hdr->magic, binchan_magic, sizeof(binchan_magic));
+    hdr->type = binchan_type;
+    hdr->flags = flags;
+    hdr->stream = binchan_stream;
+    hdr->offset = binchan_offset;
+    hdr->raw_len = (uint32_t)raw_len;
+    hdr->wire_len = (uint32_t)wire_len;
+
+    size_t len = BINCHAN_HEADER_SIZE + wire_len;
+    uint32_t crc = crc32(0, frame + sizeof(binchan_magic), len - sizeof(binchan_magic));
+    memcpy(frame + len, &crc, sizeof(crc));
+
+    uart_write((const char *)frame, len + sizeof(crc));
+
+    binchan_offset += raw_len;
+}
+
+bool binchan_open(enum binchan_type type, uint64_t offset) {
+    if (__atomic_exchange_n(&binchan_busy, 1, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    binchan_stream++;
+    binchan_type = (uint8_t)type;
+    binchan_offset = offset;
+    chunk_len = 0;
+    return true;
+}
+
+void binchan_write(const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    while (len > 0) {
+        if (chunk_len == 0 && len >= BINCHAN_CHUNK) {
+            binchan_send(p, BINCHAN_CHUNK, 0);
+            p += BINCHAN_CHUNK;
+            len -= BINCHAN_CHUNK;
+            continue;
+        }
+
+        size_t n = BINCHAN_CHUNK - chunk_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(chunk + chunk_len, p, n);
+        chunk_len += n;
+        p += n;
+        len -= n;
+
+        if (chunk_len == BINCHAN_CHUNK) {
+            binchan_send(chunk, chunk_len, 0);
+            chunk_len = 0;
+        }
+    }
+}
+
+void binchan_close(void) {
+    binchan_send(chunk, chunk_len, BINCHAN_F_LAST);
+    chunk_len = 0;
+    __atomic_store_n(&binchan_busy, 0, __ATOMIC_RELEASE);
+}
+
+bool binchan_dump_memory(const void *addr, size_t len) {
+    if (!binchan_open(BINCHAN_MEMORY, (uintptr_t)addr)) {
+        return false;
+    }
+    binchan_write(addr, len);
+    binchan_close();
+    return true;
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include "drivers/timer.h"
+#include "lib/boottime.h"
+#include "lib/printk.h"
+
+// Stamps are raw counter values, so marks taken before timer_init() are
+// as good as later ones; they are only converted when printed. The
+// counter runs from machine reset, so _start itself shows how long
+// firmware (or QEMU's loader) took.
+
+struct boot_phase {
+    const char *name;
+    uint64_t cycles;
+};
+
+extern const uint64_t boot_stamps[BOOT_STAMPS_ASM];
+
+static const char *const boot_stamp_names[BOOT_STAMPS_ASM] = {
+    "_start", "fpsimd", "mmu", "bss", "kernel_main",
+};
+
+static struct boot_phase boot_phases[BOOT_PHASES_MAX];
+static unsigned int nr_boot_phases;
+
+void boot_mark(const char *phase) {
+    if (nr_boot_phases < BOOT_PHASES_MAX) {
+        boot_phases[nr_boot_phases++] = (struct boot_phase){ phase, timer_cycles() };
+    }
+}
+
+// Times are converted as absolute counter values, then subtracted
+static void boot_time_row(const char *name, uint64_t cycles, uint64_t *prev_ns,
+                          uint64_t start_ns) {
+    uint64_t ns = timer_cycles_to_ns(cycles);
+
+    printk("        %-12s %10lu %10lu\n", name,
+           (unsigned long)((ns - start_ns) / NSEC_PER_USEC),
+           (unsigned long)((ns - *prev_ns) / NSEC_PER_USEC));
+    *prev_ns = ns;
+}
+
+void boot_time_dump(void) {
+    uint64_t start_ns = timer_cycles_to_ns(boot_stamps[0]);
+    uint64_t prev_ns = start_ns;
+
+    LOG_INFO("boot: %lu us from reset to _start, then (us):\n",
+             (unsigned long)(start_ns / NSEC_PER_USEC));
+    printk("        %-12s %10s %10s\n", "phase", "at", "took");
+
+    for (unsigned int i = 1; i < BOOT_STAMPS_ASM; i++) {
+        boot_time_row(boot_stamp_names[i], boot_stamps[i], &prev_ns, start_ns);
+    }
+    for (unsigned int i = 0; i < nr_boot_phases; i++) {
+        boot_time_row(boot_phases[i].name, boot_phases[i].cycles, &prev_ns, start_ns);
+    }
+}
@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "lib/console.h"
+#include "lib/printk.h"
+#include "lib/string.h"
+
+// The last CONSOLE_RING_SIZE bytes of log output, overwritten oldest
+// first, in two buffers that survive a warm reset.
+//
+// .persist is NOLOAD and in no program header (linker.ld): boot.S does
+// not clear it and QEMU's ELF loader does not zero it, so RAM contents
+// from before a reset are still there. Boot n writes buffer n & 1 and
+// leaves the other one, boot n - 1's, alone for the whole run:
+//
+//   persist_rings[0]                      persist_rings[1]
+//   | magic | boot 6 | head | text... |   | magic | boot 7 | head | text... |
+//            previous run, read-only               this run
+//
+// The log drainer is the only writer, so there is no writer lock, which
+// also keeps the ring usable after a panic. Readers retry around a
+// sequence count, as with a seqlock: odd while a write is in progress.
+
+#define CONSOLE_RING_MASK  (CONSOLE_RING_SIZE - 1)
+#define CONSOLE_RING_MAGIC 0x31474f4c4b4c4956ULL    // "VILKLOG1"
+
+_Static_assert((CONSOLE_RING_SIZE & CONSOLE_RING_MASK) == 0, "ring size is a power of two");
+
+struct ring_buf {
+    uint64_t magic;             // set last, once the rest is valid
+    uint64_t boot;              // boot number that wrote it
+    uint64_t head;              // bytes ever written
+    uint64_t reserved;
+    char data[CONSOLE_RING_SIZE];
+};
+
+static struct ring_buf persist_rings[2] __attribute__((section(".persist"), aligned(64)));
+static struct ring_buf *ring_cur;
+static struct ring_buf *ring_prev;
+static volatile unsigned int ring_seq;
+
+static void ring_write(const char *buf, size_t len) {
+    struct ring_buf *r = ring_cur;
+
+    __atomic_store_n(&ring_seq, ring_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // Only the tail of a span longer than the ring survives
+    if (len > CONSOLE_RING_SIZE) {
+        r->head += len - CONSOLE_RING_SIZE;
+        buf += len - CONSOLE_RING_SIZE;
+        len = CONSOLE_RING_SIZE;
+    }
+
+    size_t off = r->head & CONSOLE_RING_MASK;
+    size_t first = CONSOLE_RING_SIZE - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(r->data + off, buf, first);
+    memcpy(r->data, buf + first, len - first);
+    r->head += len;
+
+    __atomic_store_n(&ring_seq, ring_seq + 1, __ATOMIC_RELEASE);
+}
+
+static struct console ring_console = {
+    .name = "ring",
+    .write = ring_write,
+    .flags = CON_PANIC,
+};
+
+void console_ring_init(void) {
+    struct ring_buf *prev = NULL;
+
+    for (unsigned int i = 0; i < 2; i++) {
+        struct ring_buf *r = &persist_rings[i];
+        if (r->magic == CONSOLE_RING_MAGIC && r->boot && (!prev || r->boot > prev->boot)) {
+            prev = r;
+        }
+    }
+
+    uint64_t boot = prev ? prev->boot + 1 : 1;
+    struct ring_buf *cur = &persist_rings[boot & 1];
+    if (cur == prev) {
+        cur = &persist_rings[!(boot & 1)];
+    }
+
+    // Invalidate before reuse, so a reset half way leaves no stale header
+    __atomic_store_n(&cur->magic, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    cur->boot = boot;
+    cur->head = 0;
+    __atomic_store_n(&cur->magic, CONSOLE_RING_MAGIC, __ATOMIC_RELEASE);
+
+    ring_cur = cur;
+    ring_prev = prev;
+    console_register(&ring_console);
+}
+
+unsigned long console_ring_boot(void) {
+    return ring_cur ? (unsigned long)ring_cur->boot : 0;
+}
+
+// The newest min(size, stored) bytes as up to two spans
+static size_t ring_spans(const struct ring_buf *r, size_t size,
+                         const char **first, size_t *first_len, const char **second) {
+    uint64_t head = r->head;
+    size_t len = head < CONSOLE_RING_SIZE ? (size_t)head : CONSOLE_RING_SIZE;
+    if (len > size) {
+        len = size;
+    }
+
+    size_t off = (head - len) & CONSOLE_RING_MASK;
+    *first = r->data + off;
+    *first_len = CONSOLE_RING_SIZE - off < len ? CONSOLE_RING_SIZE - off : len;
+    *second = r->data;
+    return len;
+}
+
+static size_t ring_copy(const struct ring_buf *r, char *buf, size_t size) {
+    const char *first, *second;
+    size_t first_len;
+    size_t len = ring_spans(r, size, &first, &first_len, &second);
+
+    memcpy(buf, first, first_len);
+    memcpy(buf + first_len, second, len - first_len);
+    return len;
+}
+
+size_t console_ring_read(char *buf, size_t size) {
+    unsigned int seq;
+    size_t len;
+
+    if (!ring_cur) {
+        return 0;
+    }
+    do {
+        while ((seq = __atomic_load_n(&ring_seq, __ATOMIC_ACQUIRE)) & 1) {
+            cpu_relax();
+        }
+        len = ring_copy(ring_cur, buf, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&ring_seq, __ATOMIC_RELAXED) != seq);
+
+    return len;
+}
+
+// Nothing writes the previous boot's buffer, so no retry loop
+size_t console_ring_read_prev(char *buf, size_t size) {
+    return ring_prev ? ring_copy(ring_prev, buf, size) : 0;
+}
+
+void console_ring_dump_prev(void) {
+    const char *first, *second;
+    size_t first_len;
+    char line[64];
+
+    if (!ring_prev || !ring_prev->head) {
+        return;
+    }
+
+    // Straight from the buffer: 16 KiB would not fit through the log rings
+    size_t len = ring_spans(ring_prev, CONSOLE_RING_SIZE, &first, &first_len, &second);
+    size_t n = (size_t)snprintk(line, sizeof(line), "----- boot %lu log, %lu bytes%s -----\n",
+                                (unsigned long)ring_prev->boot, (unsigned long)len,
+                                ring_prev->head > len ? " (tail)" : "");
+    console_write_terminal(line, n);
+    console_write_terminal(first, first_len);
+    console_write_terminal(second, len - first_len);
+    n = (size_t)snprintk(line, sizeof(line), "----- end of boot %lu log -----\n",
+                         (unsigned long)ring_prev->boot);
+    console_write_terminal(line, n);
+}
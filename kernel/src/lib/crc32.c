@@ -0,0 +1,24 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "lib/crc32.h"
+
+// Reflected polynomial 0xEDB88320, four bits per step: a 64-byte table
+// instead of the usual 1 KiB, at half the speed of the byte-wise version.
+static const uint32_t crc32_nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0xF];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0xF];
+    }
+    return ~crc;
+}
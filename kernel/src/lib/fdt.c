@@ -0,0 +1,133 @@
+#include <stddef.h>
+#include "lib/fdt.h"
+
+#define FDT_ALIGN(x) (((x) + 3) & ~3)
+
+static inline const struct fdt_header *fdt_hdr(const void *fdt) {
+    return (const struct fdt_header *)fdt;
+}
+
+static inline const char *fdt_struct(const void *fdt) {
+    return (const char *)fdt + fdt32_to_cpu(fdt_hdr(fdt)->off_dt_struct);
+}
+
+static inline const char *fdt_strings(const void *fdt) {
+    return (const char *)fdt + fdt32_to_cpu(fdt_hdr(fdt)->off_dt_strings);
+}
+
+static inline uint32_t fdt_be32_at(const char *p) {
+    return fdt32_to_cpu(*(const uint32_t *)p);
+}
+
+static size_t fdt_strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+static bool fdt_streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+bool fdt_check_header(const void *fdt) {
+    if (!fdt || ((uintptr_t)fdt & 7)) {
+        return false;
+    }
+    return fdt32_to_cpu(fdt_hdr(fdt)->magic) == FDT_MAGIC &&
+           fdt32_to_cpu(fdt_hdr(fdt)->last_comp_version) <= 17;
+}
+
+uint32_t fdt_totalsize(const void *fdt) {
+    return fdt32_to_cpu(fdt_hdr(fdt)->totalsize);
+}
+
+// Decode the tag at offset and return it; *next is set to the following tag.
+static uint32_t fdt_next_tag(const void *fdt, int offset, int *next) {
+    const char *base = fdt_struct(fdt);
+    int limit = (int)fdt32_to_cpu(fdt_hdr(fdt)->size_dt_struct);
+
+    if (offset < 0 || offset + 4 > limit) {
+        return FDT_END;
+    }
+
+    uint32_t tag = fdt_be32_at(base + offset);
+    int pos = offset + 4;
+
+    switch (tag) {
+        case FDT_BEGIN_NODE:
+            pos += (int)fdt_strlen(base + pos) + 1;
+            break;
+        case FDT_PROP:
+            pos += 8 + (int)fdt_be32_at(base + pos);
+            break;
+        case FDT_END_NODE:
+        case FDT_NOP:
+            break;
+        default:
+            return FDT_END;
+    }
+
+    *next = FDT_ALIGN(pos);
+    return tag;
+}
+
+const void *fdt_getprop(const void *fdt, int nodeoffset,
+                        const char *name, int *lenp) {
+    const char *base = fdt_struct(fdt);
+    const char *strings = fdt_strings(fdt);
+    int offset, next;
+
+    if (fdt_next_tag(fdt, nodeoffset, &offset) != FDT_BEGIN_NODE) {
+        return NULL;
+    }
+
+    while (1) {
+        uint32_t tag = fdt_next_tag(fdt, offset, &next);
+
+        if (tag == FDT_PROP) {
+            uint32_t len = fdt_be32_at(base + offset + 4);
+            uint32_t nameoff = fdt_be32_at(base + offset + 8);
+
+            if (fdt_streq(strings + nameoff, name)) {
+                if (lenp) {
+                    *lenp = (int)len;
+                }
+                return base + offset + 12;
+            }
+        } else if (tag != FDT_NOP) {
+            // Properties always precede subnodes
+            return NULL;
+        }
+        offset = next;
+    }
+}
+
+static int fdt_cells(const void *fdt, int nodeoffset, const char *name, int dflt) {
+    int len;
+    const uint32_t *val = fdt_getprop(fdt, nodeoffset, name, &len);
+
+    return (val && len == 4) ? (int)fdt32_to_cpu(*val) : dflt;
+}
+
+int fdt_address_cells(const void *fdt, int nodeoffset) {
+    return fdt_cells(fdt, nodeoffset, "#address-cells", 2);
+}
+
+int fdt_size_cells(const void *fdt, int nodeoffset) {
+    return fdt_cells(fdt, nodeoffset, "#size-cells", 1);
+}
+
+uint64_t fdt_read_cells(const uint32_t **cells, int count) {
+    uint64_t val = 0;
+
+    while (count-- > 0) {
+        val = (val << 32) | fdt32_to_cpu(*(*cells)++);
+    }
+    return val;
+}
@@ -0,0 +1,467 @@
+#include <stddef.h>
+#include "lib/fdt.h"
+#include "lib/printk.h"
+
+// One-pass index over the DTB structure block.
+//
+// fdt_index_init() walks the blob once and records every node in a flat
+// array (in document order, so sorted by offset). Three open-addressed
+// hash tables sit on top of it:
+//   - full path       -> node     ("/pl011@9000000")
+//   - path without unit addresses -> first such node  ("/pl011")
+//   - phandle         -> node
+// and every string of every "compatible" property is chained into a
+// separate hash so "find compatible = arm,pl011" costs one bucket walk
+// instead of a scan of the blob. Hash hits are always verified against
+// the blob, so collisions only cost time.
+
+#define FDT_MAX_NODES   512
+#define FDT_MAX_COMPAT  1024
+#define FDT_MAX_DEPTH   16
+#define FDT_HASH_BITS   10      // 1024 slots, >= 2 * FDT_MAX_NODES
+#define FDT_HASH_SIZE   (1U << FDT_HASH_BITS)
+#define FDT_HASH_MASK   (FDT_HASH_SIZE - 1)
+
+#define FNV_OFFSET 0x811C9DC5U
+#define FNV_PRIME  0x01000193U
+
+struct fdt_index_node {
+    int32_t offset;         // structure block offset of FDT_BEGIN_NODE
+    int16_t parent;         // node index, -1 for the root
+    uint8_t depth;
+    uint32_t phandle;
+};
+
+struct fdt_hash_entry {
+    uint32_t key;
+    uint16_t node;          // node index + 1, 0 marks an empty slot
+};
+
+struct fdt_compat_entry {
+    uint32_t hash;
+    uint16_t node;
+    uint16_t next;          // entry index + 1, 0 ends the chain
+};
+
+static const void *fdt_blob_ptr;
+static const char *fdt_struct_ptr;
+static struct fdt_index_node nodes[FDT_MAX_NODES];
+static unsigned int nr_nodes;
+
+static struct fdt_hash_entry path_table[FDT_HASH_SIZE];
+static struct fdt_hash_entry stripped_table[FDT_HASH_SIZE];
+static struct fdt_hash_entry phandle_table[FDT_HASH_SIZE];
+
+static struct fdt_compat_entry compat[FDT_MAX_COMPAT];
+static unsigned int nr_compat;
+static uint16_t compat_head[FDT_HASH_SIZE];     // entry index + 1
+static uint16_t compat_tail[FDT_HASH_SIZE];
+
+static inline uint32_t fnv_byte(uint32_t h, char c) {
+    return (h ^ (unsigned char)c) * FNV_PRIME;
+}
+
+static uint32_t fnv_mem(uint32_t h, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h = fnv_byte(h, s[i]);
+    }
+    return h;
+}
+
+static size_t name_len(const char *s, bool strip_unit) {
+    size_t n = 0;
+    while (s[n] && !(strip_unit && s[n] == '@')) {
+        n++;
+    }
+    return n;
+}
+
+static bool str_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static inline const char *node_name(unsigned int idx) {
+    return fdt_struct_ptr + nodes[idx].offset + 4;
+}
+
+// Path hash of a child: "/" + name below the root, parent + "/" + name
+// deeper down. The root itself hashes as "/".
+static uint32_t child_hash(uint32_t parent_hash, unsigned int depth,
+                           const char *name, size_t len) {
+    if (depth > 1) {
+        parent_hash = fnv_byte(parent_hash, '/');
+    }
+    return fnv_mem(parent_hash, name, len);
+}
+
+static inline uint32_t hash_slot(uint32_t key) {
+    return (key * 0x9E3779B1U) >> (32 - FDT_HASH_BITS);
+}
+
+// Linear probing; equal keys end up in insertion (document) order.
+static void table_insert(struct fdt_hash_entry *table, uint32_t key, unsigned int node) {
+    uint32_t slot = hash_slot(key);
+
+    while (table[slot].node) {
+        slot = (slot + 1) & FDT_HASH_MASK;
+    }
+    table[slot] = (struct fdt_hash_entry){ key, (uint16_t)(node + 1) };
+}
+
+static void compat_add(uint32_t hash, unsigned int node) {
+    if (nr_compat == FDT_MAX_COMPAT) {
+        return;
+    }
+
+    unsigned int e = nr_compat++;
+    uint32_t bucket = hash & FDT_HASH_MASK;
+
+    compat[e] = (struct fdt_compat_entry){ hash, (uint16_t)node, 0 };
+    if (compat_tail[bucket]) {
+        compat[compat_tail[bucket] - 1].next = (uint16_t)(e + 1);
+    } else {
+        compat_head[bucket] = (uint16_t)(e + 1);
+    }
+    compat_tail[bucket] = (uint16_t)(e + 1);
+}
+
+int fdt_index_init(const void *fdt) {
+    if (!fdt_check_header(fdt)) {
+        return -1;
+    }
+
+    const struct fdt_header *hdr = fdt;
+    const char *base = (const char *)fdt + fdt32_to_cpu(hdr->off_dt_struct);
+    const char *strings = (const char *)fdt + fdt32_to_cpu(hdr->off_dt_strings);
+    int limit = (int)fdt32_to_cpu(hdr->size_dt_struct);
+
+    int16_t stack[FDT_MAX_DEPTH];
+    uint32_t full[FDT_MAX_DEPTH];
+    uint32_t stripped[FDT_MAX_DEPTH];
+    int depth = 0;
+    int offset = 0;
+
+    fdt_struct_ptr = base;
+
+    while (offset + 4 <= limit) {
+        uint32_t tag = fdt32_to_cpu(*(const uint32_t *)(base + offset));
+        int pos = offset + 4;
+
+        if (tag == FDT_BEGIN_NODE) {
+            const char *name = base + pos;
+            size_t len = name_len(name, false);
+
+            if (nr_nodes == FDT_MAX_NODES || depth == FDT_MAX_DEPTH) {
+                LOG_ERROR("fdt: index full at offset %d\n", offset);
+                return -1;
+            }
+
+            unsigned int idx = nr_nodes++;
+            struct fdt_index_node *node = &nodes[idx];
+
+            node->offset = offset;
+            node->depth = (uint8_t)depth;
+            node->phandle = 0;
+            if (depth == 0) {
+                node->parent = -1;
+                full[0] = stripped[0] = fnv_byte(FNV_OFFSET, '/');
+            } else {
+                node->parent = stack[depth - 1];
+                full[depth] = child_hash(full[depth - 1], depth, name, len);
+                stripped[depth] = child_hash(stripped[depth - 1], depth, name,
+                                             name_len(name, true));
+            }
+
+            table_insert(path_table, full[depth], idx);
+            table_insert(stripped_table, stripped[depth], idx);
+            stack[depth++] = (int16_t)idx;
+            pos += (int)len + 1;
+        } else if (tag == FDT_END_NODE) {
+            if (--depth <= 0) {
+                break;
+            }
+        } else if (tag == FDT_PROP && depth > 0) {
+            uint32_t len = fdt32_to_cpu(*(const uint32_t *)(base + pos));
+            const char *pname = strings + fdt32_to_cpu(*(const uint32_t *)(base + pos + 4));
+            const char *val = base + pos + 8;
+            unsigned int cur = (unsigned int)stack[depth - 1];
+
+            if (len == 4 && (str_eq(pname, "phandle") || str_eq(pname, "linux,phandle"))) {
+                nodes[cur].phandle = fdt32_to_cpu(*(const uint32_t *)val);
+                table_insert(phandle_table, nodes[cur].phandle, cur);
+            } else if (str_eq(pname, "compatible")) {
+                for (uint32_t i = 0; i < len;) {
+                    size_t slen = name_len(val + i, false);
+                    compat_add(fnv_mem(FNV_OFFSET, val + i, slen), cur);
+                    i += (uint32_t)slen + 1;
+                }
+            }
+            pos += 8 + (int)len;
+        } else if (tag != FDT_NOP) {    // FDT_END, or garbage
+            break;
+        }
+
+        offset = (pos + 3) & ~3;
+    }
+
+    // Only a complete index goes live: every lookup checks fdt_blob_ptr
+    fdt_blob_ptr = fdt;
+    LOG_DEBUG("fdt: indexed %u nodes, %u compatible strings\n", nr_nodes, nr_compat);
+    return 0;
+}
+
+const void *fdt_blob(void) {
+    return fdt_blob_ptr;
+}
+
+// libfdt rule: a component without '@' matches a node name with any unit
+// address, a component with '@' must match exactly.
+static bool component_matches(const char *node, const char *comp, size_t len) {
+    bool has_unit = false;
+
+    for (size_t i = 0; i < len; i++) {
+        if (node[i] != comp[i]) {
+            return false;
+        }
+        has_unit |= comp[i] == '@';
+    }
+    return node[len] == '\0' || (!has_unit && node[len] == '@');
+}
+
+static bool node_has_path(unsigned int idx, const char *path) {
+    unsigned int chain[FDT_MAX_DEPTH];
+    unsigned int depth = nodes[idx].depth;
+
+    for (int i = (int)idx; i > 0; i = nodes[i].parent) {
+        chain[nodes[i].depth] = (unsigned int)i;
+    }
+
+    for (unsigned int level = 1; level <= depth; level++) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = 0;
+        while (path[len] && path[len] != '/') {
+            len++;
+        }
+        if (!len || !component_matches(node_name(chain[level]), path, len)) {
+            return false;
+        }
+        path += len;
+    }
+
+    while (*path == '/') {
+        path++;
+    }
+    return *path == '\0';
+}
+
+static uint32_t path_hash(const char *path, bool strip_unit) {
+    uint32_t h = fnv_byte(FNV_OFFSET, '/');
+    unsigned int depth = 1;
+
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = 0;
+        while (path[len] && path[len] != '/') {
+            len++;
+        }
+        if (!len) {
+            break;
+        }
+
+        size_t hashed = len;
+        if (strip_unit) {
+            hashed = 0;
+            while (hashed < len && path[hashed] != '@') {
+                hashed++;
+            }
+        }
+        h = child_hash(h, depth++, path, hashed);
+        path += len;
+    }
+    return h;
+}
+
+static int table_find_path(const struct fdt_hash_entry *table, const char *path,
+                           bool strip_unit) {
+    uint32_t key = path_hash(path, strip_unit);
+
+    for (uint32_t slot = hash_slot(key); table[slot].node;
+         slot = (slot + 1) & FDT_HASH_MASK) {
+        unsigned int idx = table[slot].node - 1;
+        if (table[slot].key == key && node_has_path(idx, path)) {
+            return nodes[idx].offset;
+        }
+    }
+    return -1;
+}
+
+int fdt_find_node(const char *path) {
+    if (!fdt_blob_ptr || *path != '/') {
+        return -1;
+    }
+
+    int offset = table_find_path(path_table, path, false);
+    if (offset < 0) {
+        offset = table_find_path(stripped_table, path, true);
+    }
+    return offset;
+}
+
+int fdt_find_phandle(uint32_t phandle) {
+    if (!fdt_blob_ptr || phandle == 0) {
+        return -1;
+    }
+
+    for (uint32_t slot = hash_slot(phandle); phandle_table[slot].node;
+         slot = (slot + 1) & FDT_HASH_MASK) {
+        if (phandle_table[slot].key == phandle) {
+            return nodes[phandle_table[slot].node - 1].offset;
+        }
+    }
+    return -1;
+}
+
+// Does the compatible property of node contain exactly str?
+static bool node_is_compatible(unsigned int idx, const char *str) {
+    int len;
+    const char *val = fdt_getprop(fdt_blob_ptr, nodes[idx].offset, "compatible", &len);
+
+    for (int i = 0; val && i < len;) {
+        if (str_eq(val + i, str)) {
+            return true;
+        }
+        i += (int)name_len(val + i, false) + 1;
+    }
+    return false;
+}
+
+int fdt_find_compatible(int from, const char *compatible) {
+    if (!fdt_blob_ptr) {
+        return -1;
+    }
+
+    uint32_t hash = fnv_mem(FNV_OFFSET, compatible, name_len(compatible, false));
+
+    for (unsigned int e = compat_head[hash & FDT_HASH_MASK]; e; e = compat[e - 1].next) {
+        const struct fdt_compat_entry *entry = &compat[e - 1];
+        if (entry->hash == hash && nodes[entry->node].offset > from &&
+            node_is_compatible(entry->node, compatible)) {
+            return nodes[entry->node].offset;
+        }
+    }
+    return -1;
+}
+
+// Nodes are stored in document order, so offsets are sorted.
+static int node_index(int offset) {
+    int lo = 0, hi = (int)nr_nodes - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (nodes[mid].offset == offset) {
+            return mid;
+        }
+        if (nodes[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int fdt_parent(int offset) {
+    int idx = node_index(offset);
+
+    if (idx <= 0) {
+        return -1;
+    }
+    return nodes[nodes[idx].parent].offset;
+}
+
+int fdt_next_child(int parent, int prev) {
+    int pidx = node_index(parent);
+    int idx = (prev < 0) ? pidx : node_index(prev);
+
+    if (pidx < 0 || idx < 0) {
+        return -1;
+    }
+
+    // A node's subtree is the run of deeper nodes right after it
+    for (unsigned int i = (unsigned int)idx + 1;
+         i < nr_nodes && nodes[i].depth > nodes[pidx].depth; i++) {
+        if (nodes[i].parent == pidx) {
+            return nodes[i].offset;
+        }
+    }
+    return -1;
+}
+
+bool fdt_get_reg(int offset, unsigned int index, uint64_t *addr, uint64_t *size) {
+    int parent = fdt_parent(offset);
+    int len;
+
+    if (parent < 0) {
+        return false;
+    }
+
+    int ac = fdt_address_cells(fdt_blob_ptr, parent);
+    int sc = fdt_size_cells(fdt_blob_ptr, parent);
+    const uint32_t *reg = fdt_getprop(fdt_blob_ptr, offset, "reg", &len);
+
+    if (!reg || (int)((index + 1) * (ac + sc) * 4) > len) {
+        return false;
+    }
+
+    reg += index * (ac + sc);
+    *addr = fdt_read_cells(&reg, ac);
+    *size = fdt_read_cells(&reg, sc);
+    return true;
+}
+
+// Resolve entry index of a node's "interrupts" to a GIC interrupt ID
+// (SPI n -> 32 + n, PPI n -> 16 + n), following interrupt-parent.
+int fdt_get_irq(int offset, unsigned int index) {
+    int len;
+    const uint32_t *irqs = fdt_getprop(fdt_blob_ptr, offset, "interrupts", &len);
+    int ctrl = -1;
+
+    if (!irqs) {
+        return -1;
+    }
+
+    for (int node = offset; node >= 0 && ctrl < 0; node = fdt_parent(node)) {
+        const uint32_t *ph = fdt_getprop(fdt_blob_ptr, node, "interrupt-parent", NULL);
+        if (ph) {
+            ctrl = fdt_find_phandle(fdt32_to_cpu(*ph));
+        }
+    }
+    if (ctrl < 0) {
+        return -1;
+    }
+
+    const uint32_t *cells_prop = fdt_getprop(fdt_blob_ptr, ctrl, "#interrupt-cells", NULL);
+    unsigned int cells = cells_prop ? fdt32_to_cpu(*cells_prop) : 3;
+
+    if (cells < 2 || (int)((index + 1) * cells * 4) > len) {
+        return -1;
+    }
+
+    irqs += index * cells;
+    uint32_t type = fdt32_to_cpu(irqs[0]);
+    uint32_t num = fdt32_to_cpu(irqs[1]);
+    return (int)(num + (type == 1 ? 16 : 32));
+}
+
+void fdt_index_dump(void) {
+    LOG_INFO("fdt: %u nodes, %u compatible strings indexed (blob at %p)\n",
+             nr_nodes, nr_compat, fdt_blob_ptr);
+}
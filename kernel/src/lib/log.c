@@ -0,0 +1,466 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "arch/sysreg.h"
+#include "drivers/timer.h"
+#include "drivers/uart.h"
+#include "lib/console.h"
+#include "lib/log.h"
+#include "lib/printk.h"
+
+// Lock-free per-CPU log rings.
+//
+// Every CPU owns one single-producer/single-consumer ring. The producer
+// is that CPU with IRQs masked, so nothing else ever advances head; the
+// consumer is whichever CPU currently holds drain_busy, so nothing else
+// ever advances tail. Neither side waits for the other: a full ring
+// drops the record and counts it, and a busy drainer is left to finish
+// the job.
+//
+// A record is a 16-byte header followed by the text, padded to 16 bytes,
+// and never wraps; a pad record fills the end of the ring instead:
+//
+//   tail                              head
+//    v                                 v
+//   | hdr | text.. | hdr | text... |   free   | pad |
+//
+// Deferred records (LOG_REC_BINARY) hold a format pointer and raw 64-bit
+// arguments instead of text; the drainer formats them on the way out, or
+// with LOG_DEFERRED_HOST prints them as hex for tools/logdecode.py.
+//
+// The drainer repeatedly prints the oldest record at the tail of any
+// ring, so output from different CPUs comes out in timestamp order,
+// prefixed with the time and CPU at the start of each line, to every
+// selected console (lib/console.h). The console list only changes while
+// its writer holds drain_busy, so a drain always sees a stable list.
+
+#define LOG_RING_SIZE  8192     // bytes per CPU, power of two
+#define LOG_RING_MASK  (LOG_RING_SIZE - 1)
+#define LOG_REC_ALIGN  16
+#define LOG_PREFIX_MAX 32
+
+#define LOG_REC_PAD    (1 << 0) // filler up to the end of the ring
+#define LOG_REC_BINARY (1 << 1) // fmt pointer + raw arguments
+
+struct log_record {
+    uint64_t stamp;             // CNTVCT_EL0 at reservation
+    uint16_t len;               // text bytes
+    uint8_t cpu;
+    uint8_t flags;
+    uint8_t level;              // LOG_LVL_*, for console filters
+    uint8_t reserved[3];
+};
+
+_Static_assert(sizeof(struct log_record) == LOG_REC_ALIGN, "header is one alignment unit");
+
+struct log_ring {
+    struct {
+        unsigned long head;     // written by the owning CPU only
+        unsigned long dropped;
+    } prod __cacheline_aligned;
+    struct {
+        unsigned long tail;     // written by the drainer only
+        unsigned long reported; // drops already announced
+        bool mid_line;          // last text did not end with a newline
+    } cons __cacheline_aligned;
+    char data[LOG_RING_SIZE] __attribute__((aligned(LOG_REC_ALIGN)));
+};
+
+static struct log_ring log_rings[MAX_CPUS];
+static unsigned int drain_busy;
+static unsigned int drain_requested;    // a log_drain() since the last pass
+static bool log_panicked;
+static struct console *consoles;        // by priority, highest first
+
+static inline size_t rec_size(size_t len) {
+    return (sizeof(struct log_record) + len + LOG_REC_ALIGN - 1) & ~(size_t)(LOG_REC_ALIGN - 1);
+}
+
+static inline struct log_record *rec_at(struct log_ring *ring, unsigned long pos) {
+    return (struct log_record *)&ring->data[pos & LOG_RING_MASK];
+}
+
+bool log_reserve(struct log_slot *slot) {
+    slot->irq_flags = local_irq_save();
+
+    struct log_ring *ring = &log_rings[cpu_id()];
+    unsigned long head = ring->prod.head;
+    unsigned long tail = __atomic_load_n(&ring->cons.tail, __ATOMIC_ACQUIRE);
+    size_t need = rec_size(LOG_RECORD_MAX);
+    size_t to_end = LOG_RING_SIZE - (head & LOG_RING_MASK);
+    size_t pad = (to_end < need) ? to_end : 0;
+
+    if (head + pad + need - tail > LOG_RING_SIZE) {
+        ring->prod.dropped++;
+        local_irq_restore(slot->irq_flags);
+        return false;
+    }
+
+    if (pad) {
+        struct log_record *rec = rec_at(ring, head);
+        rec->len = 0;
+        rec->flags = LOG_REC_PAD;
+        head += pad;
+        __atomic_store_n(&ring->prod.head, head, __ATOMIC_RELEASE);
+    }
+
+    slot->data = (char *)(rec_at(ring, head) + 1);
+    slot->stamp = read_sysreg(cntvct_el0);
+    return true;
+}
+
+static void commit(struct log_slot *slot, size_t len, uint8_t flags) {
+    struct log_ring *ring = &log_rings[cpu_id()];
+    unsigned long head = ring->prod.head;
+    struct log_record *rec = rec_at(ring, head);
+
+    rec->stamp = slot->stamp;
+    rec->len = (uint16_t)len;
+    rec->cpu = (uint8_t)cpu_id();
+    rec->flags = flags;
+    rec->level = slot->level;
+    __atomic_store_n(&ring->prod.head, head + rec_size(len), __ATOMIC_RELEASE);
+
+    local_irq_restore(slot->irq_flags);
+}
+
+void log_commit(struct log_slot *slot, size_t len) {
+    commit(slot, len, 0);
+}
+
+void log_deferred(int level, const char *fmt, const uint64_t *argv, unsigned int argc) {
+    struct log_slot slot;
+
+    if (argc > LOG_DEFER_MAX_ARGS || !log_reserve(&slot)) {
+        return;
+    }
+    slot.level = (uint8_t)level;
+
+    uint64_t *words = (uint64_t *)slot.data;
+    words[0] = (uintptr_t)fmt;
+    for (unsigned int i = 0; i < argc; i++) {
+        words[1 + i] = argv[i];
+    }
+    commit(&slot, (1 + argc) * sizeof(uint64_t), LOG_REC_BINARY);
+}
+
+// Oldest committed record of a ring, skipping pad records. Drainer only.
+static struct log_record *ring_peek(struct log_ring *ring) {
+    unsigned long head = __atomic_load_n(&ring->prod.head, __ATOMIC_ACQUIRE);
+
+    while (ring->cons.tail != head) {
+        struct log_record *rec = rec_at(ring, ring->cons.tail);
+        if (!(rec->flags & LOG_REC_PAD)) {
+            return rec;
+        }
+        ring->cons.tail += LOG_RING_SIZE - (ring->cons.tail & LOG_RING_MASK);
+    }
+    return NULL;
+}
+
+static size_t format_prefix(char *buf, const struct log_record *rec) {
+    uint64_t ns = timer_cycles_to_ns(rec->stamp);
+    uint64_t secs = ns / NSEC_PER_SEC;
+    uint64_t usecs = (ns % NSEC_PER_SEC) / NSEC_PER_USEC;
+    return (size_t)snprintk(buf, LOG_PREFIX_MAX, "[%5lu.%06lu] cpu%u ",
+                            secs, usecs, (unsigned int)rec->cpu);
+}
+
+// Turn a binary record into text in buf
+static size_t format_binary(char *buf, const struct log_record *rec) {
+    const uint64_t *words = (const uint64_t *)(rec + 1);
+    unsigned int argc = rec->len / sizeof(uint64_t) - 1;
+
+#ifdef LOG_DEFERRED_HOST
+    size_t len = (size_t)snprintk(buf, LOG_RECORD_MAX, "#D %lx", words[0]);
+    for (unsigned int i = 0; i < argc; i++) {
+        len += (size_t)snprintk(buf + len, LOG_RECORD_MAX - len, " %lx", words[1 + i]);
+    }
+    len += (size_t)snprintk(buf + len, LOG_RECORD_MAX - len, "\n");
+    return len;
+#else
+    return (size_t)snprintk_raw(buf, LOG_RECORD_MAX, (const char *)(uintptr_t)words[0],
+                                words + 1, argc);
+#endif
+}
+
+// The terminal that gets the log: the first one in priority order
+static struct console *best_terminal(void) {
+    for (struct console *con = consoles; con; con = con->next) {
+        if ((con->flags & CON_TERMINAL) && (!log_panicked || (con->flags & CON_PANIC))) {
+            return con;
+        }
+    }
+    return NULL;
+}
+
+static bool console_selected(const struct console *con, const struct console *terminal) {
+    if (con->flags & CON_TERMINAL) {
+        return con == terminal;
+    }
+    return !log_panicked || (con->flags & CON_PANIC);
+}
+
+// Selected, and not filtering out records of this level
+static bool console_takes(const struct console *con, const struct console *terminal,
+                          unsigned int level) {
+    return level <= (unsigned int)con->level && console_selected(con, terminal);
+}
+
+static size_t consoles_room(const struct console *terminal, unsigned int level) {
+    size_t room = SIZE_MAX;
+
+    if (log_panicked) {
+        return room;
+    }
+    for (struct console *con = consoles; con; con = con->next) {
+        if (con->room && console_takes(con, terminal, level)) {
+            size_t r = con->room();
+            room = r < room ? r : room;
+        }
+    }
+    return room;
+}
+
+static void consoles_write(const struct console *terminal, unsigned int level,
+                           const char *buf, size_t len) {
+    for (struct console *con = consoles; con; con = con->next) {
+        if (console_takes(con, terminal, level)) {
+            con->write(buf, len);
+        }
+    }
+}
+
+static void consoles_flush(const struct console *terminal) {
+    for (struct console *con = consoles; con; con = con->next) {
+        if (con->flush && console_selected(con, terminal)) {
+            con->flush();
+        }
+    }
+}
+
+// Returns false if it stopped because a console ran out of room.
+static bool drain_records(const struct console *terminal) {
+    char prefix[LOG_PREFIX_MAX];
+    char text_buf[LOG_RECORD_MAX];
+
+    for (;;) {
+        struct log_ring *oldest = NULL;
+        struct log_record *rec = NULL;
+
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            struct log_record *r = ring_peek(&log_rings[cpu]);
+            if (r && (!rec || r->stamp < rec->stamp)) {
+                oldest = &log_rings[cpu];
+                rec = r;
+            }
+        }
+        if (!rec) {
+            return true;
+        }
+
+        const char *text = (const char *)(rec + 1);
+        size_t len = rec->len;
+        if (rec->flags & LOG_REC_BINARY) {
+            len = format_binary(text_buf, rec);
+            text = text_buf;
+        }
+
+        size_t plen = oldest->cons.mid_line ? 0 : format_prefix(prefix, rec);
+        unsigned long dropped = __atomic_load_n(&oldest->prod.dropped, __ATOMIC_RELAXED);
+
+        if (consoles_room(terminal, rec->level) < plen + len + LOG_PREFIX_MAX) {
+            return false;
+        }
+
+        consoles_write(terminal, rec->level, prefix, plen);
+        consoles_write(terminal, rec->level, text, len);
+        oldest->cons.mid_line = len && text[len - 1] != '\n';
+
+        if (dropped != oldest->cons.reported && !oldest->cons.mid_line) {
+            plen = (size_t)snprintk(prefix, LOG_PREFIX_MAX, "[log: %lu dropped]\n",
+                                    dropped - oldest->cons.reported);
+            consoles_write(terminal, LOG_LVL_NONE, prefix, plen);
+            oldest->cons.reported = dropped;
+        }
+
+        __atomic_store_n(&oldest->cons.tail, oldest->cons.tail + rec_size(rec->len),
+                         __ATOMIC_RELEASE);
+    }
+}
+
+// Records stay in the rings until there is a console to take them;
+// console_register() drains again
+static bool drain_locked(void) {
+    if (!consoles) {
+        return false;
+    }
+
+    const struct console *terminal = best_terminal();
+    bool done = drain_records(terminal);
+    consoles_flush(terminal);
+    return done;
+}
+
+static bool log_pending(void) {
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct log_ring *ring = &log_rings[cpu];
+        if (__atomic_load_n(&ring->prod.head, __ATOMIC_ACQUIRE) != ring->cons.tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void log_drain(void) {
+    if (log_panicked) {
+        drain_locked();
+        return;
+    }
+
+    // A caller that finds drain_busy taken leaves drain_requested set
+    // before it goes: a producer with a new record, or the UART with
+    // room again after the holder stopped short for lack of it. The
+    // holder looks at the flag after letting go, so neither waits for
+    // the next printk.
+    bool done;
+    do {
+        __atomic_store_n(&drain_requested, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_exchange_n(&drain_busy, 1, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        __atomic_store_n(&drain_requested, 0, __ATOMIC_SEQ_CST);
+        done = drain_locked();
+        __atomic_store_n(&drain_busy, 0, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&drain_requested, __ATOMIC_SEQ_CST) || (done && log_pending()));
+}
+
+void log_panic(void) {
+    log_panicked = true;
+    drain_locked();
+}
+
+void log_init(void) {
+    uart_set_tx_refill(log_drain);
+    console_ring_init();
+}
+
+// Take drain_busy for the console list, waiting out a running drain
+static void console_list_lock(void) {
+    while (__atomic_exchange_n(&drain_busy, 1, __ATOMIC_SEQ_CST)) {
+        cpu_relax();
+    }
+}
+
+static void console_list_unlock(void) {
+    __atomic_store_n(&drain_busy, 0, __ATOMIC_SEQ_CST);
+
+    // Records committed meanwhile, or waiting for a first console
+    log_drain();
+}
+
+void console_register(struct console *con) {
+    if (!con->level) {
+        con->level = (con->flags & CON_TERMINAL) ? CONSOLE_LOG_LEVEL : LOG_LVL_DEBUG;
+    }
+
+    console_list_lock();
+
+    struct console **pos = &consoles;
+    while (*pos && (*pos)->priority >= con->priority) {
+        pos = &(*pos)->next;
+    }
+    con->next = *pos;
+    *pos = con;
+
+    console_list_unlock();
+}
+
+void console_unregister(struct console *con) {
+    console_list_lock();
+
+    for (struct console **pos = &consoles; *pos; pos = &(*pos)->next) {
+        if (*pos == con) {
+            *pos = con->next;
+            con->next = NULL;
+            break;
+        }
+    }
+
+    console_list_unlock();
+}
+
+static bool name_is(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+void console_write_terminal(const char *buf, size_t len) {
+    console_list_lock();
+    struct console *terminal = best_terminal();
+    if (terminal) {
+        // No room() check: write() waits, while a drain would not
+        terminal->write(buf, len);
+        if (terminal->flush) {
+            terminal->flush();
+        }
+    }
+    console_list_unlock();
+}
+
+int console_set_level(const char *name, int level) {
+    int ret = -1;
+
+    console_list_lock();
+    for (struct console *con = consoles; con; con = con->next) {
+        if (name_is(con->name, name)) {
+            con->level = level;
+            ret = 0;
+        }
+    }
+    console_list_unlock();
+    return ret;
+}
+
+void console_list_dump(void) {
+    struct {
+        const char *name;
+        int priority;
+        int level;
+        unsigned int flags;
+        bool active;
+    } snap[8];
+    unsigned int n = 0;
+
+    // Copy first: printing needs a drain, which the lock would hold off
+    console_list_lock();
+    const struct console *terminal = best_terminal();
+    for (struct console *con = consoles; con && n < 8; con = con->next, n++) {
+        snap[n].name = con->name;
+        snap[n].priority = con->priority;
+        snap[n].level = con->level;
+        snap[n].flags = con->flags;
+        snap[n].active = console_selected(con, terminal);
+    }
+    console_list_unlock();
+
+    for (unsigned int i = 0; i < n; i++) {
+        LOG_INFO("console: %-12s prio %2d, level %d, %s%s%s\n", snap[i].name,
+                 snap[i].priority, snap[i].level, snap[i].flags & CON_TERMINAL ? "terminal" : "sink",
+                 snap[i].flags & CON_PANIC ? ", panic" : "",
+                 snap[i].active ? ", active" : "");
+    }
+}
+
+unsigned long log_dropped(void) {
+    unsigned long total = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        total += __atomic_load_n(&log_rings[cpu].prod.dropped, __ATOMIC_RELAXED);
+    }
+    return total;
+}
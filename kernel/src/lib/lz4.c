@@ -0,0 +1,101 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "lib/lz4.h"
+#include "lib/string.h"
+
+// Greedy LZ4 compressor. Every position's first four bytes are hashed
+// into a table of the last position that had that hash; a candidate is
+// used if its four bytes really match, and the match is extended as far
+// as it goes. Output is a series of sequences:
+//
+//   token [literal length+] literals offset(le16) [match length+]
+//   token = literal length (high nibble) | match length - 4 (low nibble)
+//
+// where a nibble of 15 continues in extra bytes of 255 each. The format
+// requires the last 5 bytes to be literals and no match to start in the
+// last 12.
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5
+#define MF_LIMIT      12
+#define HASH_BITS     12
+
+// Positions relative to the current input. Stale entries from an earlier
+// call are harmless: every candidate is checked against the data.
+static uint16_t lz4_table[1 << HASH_BITS];
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *put_literals(uint8_t *op, const uint8_t *lit, size_t len, size_t match) {
+    uint8_t *token = op++;
+
+    *token = (uint8_t)(((len < 15 ? len : 15) << 4) | (match < 15 ? match : 15));
+    if (len >= 15) {
+        op = put_length(op, len - 15);
+    }
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+size_t lz4_compress(const void *src, size_t len, void *dst) {
+    const uint8_t *base = src;
+    const uint8_t *end = base + len;
+    const uint8_t *anchor = base;
+    const uint8_t *ip = base;
+    uint8_t *op = dst;
+
+    if (len > MF_LIMIT) {
+        const uint8_t *mf_limit = end - MF_LIMIT;
+        const uint8_t *match_limit = end - LAST_LITERALS;
+
+        while (ip < mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = base + lz4_table[h];
+
+            lz4_table[h] = (uint16_t)(ip - base);
+            if (ref >= ip || read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t *mp = ip + MIN_MATCH;
+            const uint8_t *rp = ref + MIN_MATCH;
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            size_t match = (size_t)(mp - ip) - MIN_MATCH;
+            size_t offset = (size_t)(ip - ref);
+
+            op = put_literals(op, anchor, (size_t)(ip - anchor), match);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            if (match >= 15) {
+                op = put_length(op, match - 15);
+            }
+            ip = anchor = mp;
+        }
+    }
+
+    op = put_literals(op, anchor, (size_t)(end - anchor), 0);
+    return (size_t)(op - (uint8_t *)dst);
+}
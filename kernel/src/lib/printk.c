@@ -1,9 +1,67 @@
 #include <stdarg.h>
 #include <stdbool.h>
-#include "drivers/uart.h"
+#include <stdint.h>
+#include "lib/log.h"
 #include "lib/printk.h"
+#include "lib/stats.h"
+#include "lib/string.h"
 
-#define kputc(c) uart_putc(c)
+// printk formats straight into a record reserved in this CPU's log ring
+// (lib/log.c), so cores never contend on the UART or on each other. Long
+// messages continue in a further record; snprintk uses the same code with
+// a plain buffer that truncates instead.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+    struct log_slot *slot;      // NULL: fixed buffer
+} printk_buf_t;
+
+static void printk_flush(printk_buf_t *out) {
+    if (!out->slot) {
+        return;
+    }
+
+    log_commit(out->slot, out->len);
+    out->len = 0;
+    out->size = 0;
+    if (log_reserve(out->slot)) {
+        out->data = out->slot->data;
+        out->size = LOG_RECORD_MAX;
+    } else {
+        out->slot = NULL;       // ring full: drop the rest
+    }
+}
+
+static inline void kputc(printk_buf_t *out, char c) {
+    if (out->len == out->size) {
+        printk_flush(out);
+        if (out->len == out->size) {
+            return;
+        }
+    }
+    out->data[out->len++] = c;
+}
+
+// Literal text goes in as whole spans, copied to the end of the buffer
+static void kput_span(printk_buf_t *out, const char *str, size_t len) {
+    while (len) {
+        if (out->len == out->size) {
+            printk_flush(out);
+            if (out->len == out->size) {
+                return;
+            }
+        }
+        size_t n = out->size - out->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(out->data + out->len, str, n);
+        out->len += n;
+        str += n;
+        len -= n;
+    }
+}
 
 typedef struct {
     bool pad_with_zeros;
@@ -17,96 +75,171 @@ typedef struct {
     char type;
 } format_spec_t;
 
-static void print_number(long num, format_spec_t spec) {
-    unsigned long unum = (num < 0) ? -(unsigned long)num : (unsigned long)num;
-    char buffer[21];
-    bool negative = num < 0;
-    int i = 0;
+static void kput_repeat(printk_buf_t *out, char c, int count) {
+    while (count-- > 0) {
+        kputc(out, c);
+    }
+}
+
+// Integer conversion without a single divide instruction: hex digits are
+// nibbles looked up in a table, with clz giving the digit count up front;
+// decimal digits come out two at a time from a 200-byte pair table, and
+// the divide by 100 is a multiply by its 2^-66 scaled reciprocal.
+static const char hex_lower[16] = "0123456789abcdef";
+static const char hex_upper[16] = "0123456789ABCDEF";
+
+static const char dec_pairs[200] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+#define INT_DIGITS_MAX 20       // 2^64 - 1 has 20 decimal digits
+
+static inline uint64_t div100(uint64_t n) {
+    return (uint64_t)(((unsigned __int128)(n >> 2) * 0x28F5C28F5C28F5C3ULL) >> 66);
+}
+
+// Write the digits of num so they end at end; returns how many
+static int fmt_dec(char *end, uint64_t num) {
+    char *p = end;
 
-    if (unum == 0) {
-        buffer[i++] = '0';
+    while (num >= 100) {
+        uint64_t q = div100(num);
+        unsigned int r = (unsigned int)(num - q * 100) * 2;
+
+        p -= 2;
+        p[0] = dec_pairs[r];
+        p[1] = dec_pairs[r + 1];
+        num = q;
+    }
+    if (num >= 10) {
+        p -= 2;
+        p[0] = dec_pairs[num * 2];
+        p[1] = dec_pairs[num * 2 + 1];
     } else {
-        while (unum > 0) {
-            buffer[i++] = '0' + (unum % 10);
-            unum /= 10;
-        }
+        *--p = '0' + num;
     }
+    return end - p;
+}
 
-    int digits = i;
-    int pad = (spec.width > digits + (negative ? 1 : 0))
-              ? (spec.width - digits - (negative ? 1 : 0))
-              : 0;
+static int fmt_hex(char *end, uint64_t num, bool capital) {
+    const char *digits = capital ? hex_upper : hex_lower;
+    int count = num ? (67 - __builtin_clzl(num)) >> 2 : 1;
 
-    if (negative && spec.pad_with_zeros) {
-        kputc('-');
+    for (int i = 1; i <= count; i++) {
+        end[-i] = digits[num & 0xF];
+        num >>= 4;
     }
+    return count;
+}
 
-    char padder = spec.pad_with_zeros ? '0' : ' ';
-    while (pad-- > 0) {
-        kputc(padder);
+// The shared back end for %d, %u, %x, %X and %p:
+//   [spaces] [sign | 0x] [zeros] digits [spaces]
+// Precision is the minimum digit count and, as in C, turns off the '0'
+// flag; "%.0d" of zero prints no digits at all.
+static void print_integer(printk_buf_t *out, uint64_t num, char sign, format_spec_t spec) {
+    char buffer[INT_DIGITS_MAX];
+    char *end = buffer + sizeof(buffer);
+    bool hex = spec.type == 'x' || spec.type == 'X' || spec.type == 'p';
+    int digits;
+
+    if (num == 0 && spec.has_precision && spec.precision == 0) {
+        digits = 0;
+    } else if (hex) {
+        digits = fmt_hex(end, num, spec.type == 'X');
+    } else {
+        digits = fmt_dec(end, num);
     }
 
-    if (negative && !spec.pad_with_zeros) {
-        kputc('-');
+    char prefix[2];
+    int prefix_len = 0;
+    if (sign) {
+        prefix[prefix_len++] = sign;
+    } else if (hex && spec.alt_form && num != 0) {
+        prefix[prefix_len++] = '0';
+        prefix[prefix_len++] = (spec.type == 'X') ? 'X' : 'x';
     }
 
-    while (i > 0) {
-        kputc(buffer[--i]);
+    int zeros = 0;
+    if (spec.has_precision) {
+        zeros = spec.precision - digits;
+    } else if (spec.pad_with_zeros && !spec.left_align) {
+        zeros = spec.width - prefix_len - digits;
+    }
+    if (zeros < 0) {
+        zeros = 0;
     }
-}
 
-static void print_unsigned(unsigned long num, format_spec_t spec) {
-    char buffer[21];
-    int i = 0;
+    int pad = spec.width - prefix_len - zeros - digits;
 
-    if (num == 0) {
-        buffer[i++] = '0';
-    } else {
-        while (num > 0) {
-            buffer[i++] = '0' + (num % 10);
-            num /= 10;
-        }
+    if (!spec.left_align) {
+        kput_repeat(out, ' ', pad);
+    }
+    for (int i = 0; i < prefix_len; i++) {
+        kputc(out, prefix[i]);
     }
+    kput_repeat(out, '0', zeros);
+    kput_span(out, end - digits, digits);
+    if (spec.left_align) {
+        kput_repeat(out, ' ', pad);
+    }
+}
 
-    int digits = i;
-    int pad = (spec.width > digits) ? (spec.width - digits) : 0;
+// %s: precision caps the bytes taken from the string
+static void print_string(printk_buf_t *out, const char *str, format_spec_t spec) {
+    size_t len = 0;
+    size_t max = spec.has_precision ? (size_t)spec.precision : SIZE_MAX;
 
-    char padder = spec.pad_with_zeros ? '0' : ' ';
-    while (pad-- > 0) {
-        kputc(padder);
+    while (len < max && str[len]) {
+        len++;
     }
 
-    while (i > 0) {
-        kputc(buffer[--i]);
+    int pad = (spec.width > (int)len) ? spec.width - (int)len : 0;
+
+    if (!spec.left_align) {
+        kput_repeat(out, ' ', pad);
+    }
+    kput_span(out, str, len);
+    if (spec.left_align) {
+        kput_repeat(out, ' ', pad);
     }
 }
 
-static void print_hex(unsigned long num, bool capital, format_spec_t spec) {
-    char buffer[16];
-    int i = 0;
+// Arguments come from a va_list, or from the words of a deferred log
+// record, where every argument was widened to 64 bits at the call site.
+typedef struct {
+    va_list ap;
+    const uint64_t *raw;        // NULL: use ap
+    const uint64_t *raw_end;
+} printk_args_t;
 
-    if (num == 0) {
-        buffer[i++] = '0';
-    } else {
-        while (num > 0) {
-            int digit = num % 16;
-            buffer[i++] = (digit < 10) ? ('0' + digit)
-                                       : ((capital ? 'A' : 'a') + (digit - 10));
-            num /= 16;
-        }
-    }
+static inline uint64_t arg_raw(printk_args_t *args) {
+    return (args->raw < args->raw_end) ? *args->raw++ : 0;
+}
 
-    int digits = i;
-    int pad = (spec.width > digits) ? (spec.width - digits) : 0;
+static long arg_signed(printk_args_t *args, bool is_long) {
+    if (args->raw) {
+        uint64_t val = arg_raw(args);
+        return is_long ? (long)val : (int)val;
+    }
+    return is_long ? va_arg(args->ap, long) : va_arg(args->ap, int);
+}
 
-    char padder = spec.pad_with_zeros ? '0' : ' ';
-    while (pad-- > 0) {
-        kputc(padder);
+static unsigned long arg_unsigned(printk_args_t *args, bool is_long) {
+    if (args->raw) {
+        uint64_t val = arg_raw(args);
+        return is_long ? (unsigned long)val : (unsigned int)val;
     }
+    return is_long ? va_arg(args->ap, unsigned long) : va_arg(args->ap, unsigned int);
+}
 
-    while (i > 0) {
-        kputc(buffer[--i]);
+static void *arg_ptr(printk_args_t *args) {
+    if (args->raw) {
+        return (void *)(uintptr_t)arg_raw(args);
     }
+    return va_arg(args->ap, void *);
 }
 
 static format_spec_t parse_format_spec(const char **format) {
@@ -149,110 +282,276 @@ static format_spec_t parse_format_spec(const char **format) {
         (*format)++;
     }
 
+    // A '%' at the very end has no type; stay on the terminator
     spec.type = **format;
-    (*format)++;
+    if (spec.type) {
+        (*format)++;
+    }
 
     return spec;
 }
 
-void printk(const char *format, ...) {
-    va_list ap;
-    va_start(ap, format);
+// One conversion, its spec already parsed
+static void format_one(printk_buf_t *out, format_spec_t spec, printk_args_t *args) {
+    switch (spec.type) {
+        case '%': {
+            kputc(out, '%');
+            break;
+        }
+
+        case 'c': {
+            char c = (char)arg_signed(args, false);
+            kput_repeat(out, ' ', spec.left_align ? 0 : spec.width - 1);
+            kputc(out, c);
+            kput_repeat(out, ' ', spec.left_align ? spec.width - 1 : 0);
+            break;
+        }
+
+        case 's': {
+            const char *str = arg_ptr(args);
+            print_string(out, str ? str : "(null)", spec);
+            break;
+        }
+
+        case 'd': {
+            long num = arg_signed(args, spec.length_modifier == 'l');
+            char sign = (num < 0) ? '-' : (spec.show_sign ? '+' : 0);
+            unsigned long mag = (num < 0) ? -(unsigned long)num : (unsigned long)num;
+            print_integer(out, mag, sign, spec);
+            break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X': {
+            unsigned long num = arg_unsigned(args, spec.length_modifier == 'l');
+            print_integer(out, num, 0, spec);
+            break;
+        }
 
+        case 'p': {
+            void *ptr = arg_ptr(args);
+            if (ptr == NULL) {
+                spec.has_precision = false;
+                print_string(out, "(nil)", spec);
+            } else {
+                format_spec_t ptr_spec = spec;
+                ptr_spec.alt_form = true;
+                ptr_spec.has_precision = true;
+                ptr_spec.precision = 16;
+                print_integer(out, (uintptr_t)ptr, 0, ptr_spec);
+            }
+            break;
+        }
+    }
+}
+
+static void format_to(printk_buf_t *out, const char *format, printk_args_t *args) {
     while (*format) {
         if (*format == '%') {
-            format_spec_t spec = parse_format_spec(&format);
-
-            switch (spec.type) {
-                case '%': {
-                    kputc('%');
-                    break;
-                }
-
-                case 'c': {
-                    int val = va_arg(ap, int);
-                    kputc(val);
-                    break;
-                }
-
-                case 's': {
-                    const char *str = va_arg(ap, const char*);
-
-                    if (str) {
-                        while (*str) {
-                            kputc(*str++);
-                        }
-                    } else {
-                        kputc('('); kputc('n'); kputc('u'); kputc('l'); kputc('l'); kputc(')');
-                    }
-
-                    break;
-                }
-
-                case 'd': {
-                    long num;
-                    if (spec.length_modifier == 'l') {
-                        num = va_arg(ap, long);
-                    } else {
-                        num = va_arg(ap, int);
-                    }
-                    print_number(num, spec);
-                    break;
-                }
-
-                case 'u': {
-                    unsigned long num;
-                    if (spec.length_modifier == 'l') {
-                        num = va_arg(ap, unsigned long);
-                    } else {
-                        num = va_arg(ap, unsigned int);
-                    }
-                    print_unsigned(num, spec);
-                    break;
-                }
-
-                case 'p': {
-                    void *ptr = va_arg(ap, void*);
-                    if (ptr == NULL) {
-                        kputc('('); kputc('n'); kputc('i'); kputc('l'); kputc(')');
-                    } else {
-                        unsigned long addr = (unsigned long)ptr;
-                        format_spec_t ptr_spec = spec;
-                        ptr_spec.width = 16;
-                        ptr_spec.pad_with_zeros = true;
-                        kputc('0');
-                        kputc('x');
-                        print_hex(addr, false, ptr_spec);
-                    }
-                    break;
-                }
-
-                case 'x': {
-                    unsigned long num;
-                    if (spec.length_modifier == 'l') {
-                        num = va_arg(ap, unsigned long);
-                    } else {
-                        num = va_arg(ap, unsigned int);
-                    }
-                    print_hex(num, false, spec);
-                    break;
-                }
-
-                case 'X': {
-                    unsigned long num;
-                    if (spec.length_modifier == 'l') {
-                        num = va_arg(ap, unsigned long);
-                    } else {
-                        num = va_arg(ap, unsigned int);
-                    }
-                    print_hex(num, true, spec);
-                    break;
-                }
-            }
+            format_one(out, parse_format_spec(&format), args);
         } else {
-            kputc(*format++);
+            const char *lit = format;
+            while (*format && *format != '%') {
+                format++;
+            }
+            kput_span(out, lit, format - lit);
+        }
+    }
+}
+
+// Compiled formats (struct printk_fmt): each op is the literal run before
+// a conversion plus the conversion's parsed spec, so replaying a format
+// is span copies and conversions with no parsing at all.
+#define PRINTK_FMT_RAW      0   // not compiled yet
+#define PRINTK_FMT_BUSY     1   // being compiled by some CPU
+#define PRINTK_FMT_READY    2
+#define PRINTK_FMT_SLOW     3   // does not fit: always parsed
+
+#define PRINTK_OP_LEFT      (1 << 0)
+#define PRINTK_OP_ZERO      (1 << 1)
+#define PRINTK_OP_SIGN      (1 << 2)
+#define PRINTK_OP_ALT       (1 << 3)
+#define PRINTK_OP_PREC      (1 << 4)
+#define PRINTK_OP_LONG      (1 << 5)
+#define PRINTK_OP_SHORT     (1 << 6)
+
+static bool fmt_compile(struct printk_fmt *pf) {
+    const char *format = pf->format;
+    const char *p = format;
+    unsigned int n = 0;
+
+    for (;;) {
+        const char *lit = p;
+        while (*p && *p != '%') {
+            p++;
+        }
+        if (n == PRINTK_FMT_OPS || p - format > UINT16_MAX) {
+            return false;
+        }
+
+        struct printk_fmt_op *op = &pf->ops[n++];
+        op->lit_off = (uint16_t)(lit - format);
+        op->lit_len = (uint16_t)(p - lit);
+        op->type = 0;
+        if (!*p) {
+            break;
+        }
+
+        format_spec_t spec = parse_format_spec(&p);
+        if (!spec.type || spec.width > UINT16_MAX || spec.precision > UINT16_MAX) {
+            return false;       // a '%' at the very end, or absurd numbers
         }
+        op->type = (uint8_t)spec.type;
+        op->flags = (spec.left_align ? PRINTK_OP_LEFT : 0) |
+                    (spec.pad_with_zeros ? PRINTK_OP_ZERO : 0) |
+                    (spec.show_sign ? PRINTK_OP_SIGN : 0) |
+                    (spec.alt_form ? PRINTK_OP_ALT : 0) |
+                    (spec.has_precision ? PRINTK_OP_PREC : 0) |
+                    (spec.length_modifier == 'l' ? PRINTK_OP_LONG : 0) |
+                    (spec.length_modifier == 'h' ? PRINTK_OP_SHORT : 0);
+        op->width = (uint16_t)spec.width;
+        op->precision = (uint16_t)spec.precision;
     }
 
-    va_end(ap);
+    pf->nops = n;
+    return true;
+}
+
+// The first CPU to get here compiles; any other one parses meanwhile
+static bool fmt_ready(struct printk_fmt *pf) {
+    unsigned int state = __atomic_load_n(&pf->state, __ATOMIC_ACQUIRE);
+
+    if (state == PRINTK_FMT_READY) {
+        return true;
+    }
+    if (state != PRINTK_FMT_RAW ||
+        !__atomic_compare_exchange_n(&pf->state, &state, PRINTK_FMT_BUSY, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    state = fmt_compile(pf) ? PRINTK_FMT_READY : PRINTK_FMT_SLOW;
+    __atomic_store_n(&pf->state, state, __ATOMIC_RELEASE);
+    return state == PRINTK_FMT_READY;
+}
+
+static void format_ops_to(printk_buf_t *out, const struct printk_fmt *pf, printk_args_t *args) {
+    for (unsigned int i = 0; i < pf->nops; i++) {
+        const struct printk_fmt_op *op = &pf->ops[i];
+
+        kput_span(out, pf->format + op->lit_off, op->lit_len);
+        if (!op->type) {
+            continue;
+        }
+
+        format_spec_t spec = {
+            .left_align = op->flags & PRINTK_OP_LEFT,
+            .pad_with_zeros = op->flags & PRINTK_OP_ZERO,
+            .show_sign = op->flags & PRINTK_OP_SIGN,
+            .alt_form = op->flags & PRINTK_OP_ALT,
+            .has_precision = op->flags & PRINTK_OP_PREC,
+            .length_modifier = (op->flags & PRINTK_OP_LONG) ? 'l' :
+                               (op->flags & PRINTK_OP_SHORT) ? 'h' : 0,
+            .width = op->width,
+            .precision = op->precision,
+            .type = (char)op->type,
+        };
+        format_one(out, spec, args);
+    }
+}
+
+// pf: the call site's compiled format, or NULL to parse format
+static void format_out(printk_buf_t *out, const char *format, struct printk_fmt *pf,
+                       printk_args_t *args) {
+    if (pf && fmt_ready(pf)) {
+        format_ops_to(out, pf, args);
+    } else {
+        format_to(out, format, args);
+    }
+}
+
+static void vprintk_level(int level, const char *format, struct printk_fmt *pf,
+                          printk_args_t *args) {
+    struct log_slot slot;
+
+    if (!log_reserve(&slot)) {
+        return;
+    }
+
+    // Continuation records reuse the slot, so they keep the level
+    stat_inc(STAT_PRINTK);
+    slot.level = (uint8_t)level;
+    printk_buf_t buf = { slot.data, 0, LOG_RECORD_MAX, &slot };
+    format_out(&buf, format, pf, args);
+
+    if (buf.slot) {
+        log_commit(buf.slot, buf.len);
+    }
+    log_drain();
+}
+
+void printk(const char *format, ...) {
+    printk_args_t args = { .raw = NULL };
+    va_start(args.ap, format);
+    vprintk_level(LOG_LVL_NONE, format, NULL, &args);
+    va_end(args.ap);
+}
+
+void printk_level(int level, const char *format, ...) {
+    printk_args_t args = { .raw = NULL };
+    va_start(args.ap, format);
+    vprintk_level(level, format, NULL, &args);
+    va_end(args.ap);
+}
+
+void printk_fmt(int level, struct printk_fmt *pf, ...) {
+    printk_args_t args = { .raw = NULL };
+    va_start(args.ap, pf);
+    vprintk_level(level, pf->format, pf, &args);
+    va_end(args.ap);
+}
+
+int snprintk(char *str, size_t size, const char *format, ...) {
+    if (size == 0) {
+        return 0;
+    }
+
+    printk_buf_t buf = { str, 0, size - 1, NULL };
+    printk_args_t args = { .raw = NULL };
+    va_start(args.ap, format);
+    format_to(&buf, format, &args);
+    va_end(args.ap);
+
+    str[buf.len] = '\0';
+    return (int)buf.len;
+}
+
+int snprintk_fmt(char *str, size_t size, struct printk_fmt *pf, ...) {
+    if (size == 0) {
+        return 0;
+    }
+
+    printk_buf_t buf = { str, 0, size - 1, NULL };
+    printk_args_t args = { .raw = NULL };
+    va_start(args.ap, pf);
+    format_out(&buf, pf->format, pf, &args);
+    va_end(args.ap);
+
+    str[buf.len] = '\0';
+    return (int)buf.len;
+}
+
+int snprintk_raw(char *str, size_t size, const char *format,
+                 const uint64_t *argv, unsigned int argc) {
+    if (size == 0) {
+        return 0;
+    }
+
+    printk_buf_t buf = { str, 0, size - 1, NULL };
+    printk_args_t args = { .raw = argv, .raw_end = argv + argc };
+    format_to(&buf, format, &args);
+
+    str[buf.len] = '\0';
+    return (int)buf.len;
 }
@@ -0,0 +1,60 @@
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "drivers/gic.h"
+#include "lib/rcu.h"
+#include "sched/sched.h"
+
+// Each CPU counts its quiescent states. A grace period is over once every
+// other online CPU's count has moved past a snapshot taken at its start;
+// the reschedule IPI makes sure idle or busy CPUs get there promptly.
+//
+//   cpu0 synchronize_rcu()     cpu1                 cpu2
+//     snap = {-, 41, 17}         reader ...           idle (WFI)
+//     IPI cpu1, cpu2             ... reader ends
+//                                schedule(): 42       IPI -> schedule(): 18
+//     42 != 41, 18 != 17: done
+
+struct rcu_cpu {
+    unsigned long qs;
+} __cacheline_aligned;
+
+static struct rcu_cpu rcu_cpu[MAX_CPUS];
+
+void rcu_read_lock(void) {
+    preempt_disable();
+}
+
+void rcu_read_unlock(void) {
+    preempt_enable();
+}
+
+void rcu_note_qs(void) {
+    struct rcu_cpu *rc = &rcu_cpu[cpu_id()];
+
+    __atomic_store_n(&rc->qs, rc->qs + 1, __ATOMIC_RELEASE);
+}
+
+void synchronize_rcu(void) {
+    unsigned long snap[MAX_CPUS];
+    unsigned int self = cpu_id();
+
+    // Order the caller's unpublish before the snapshot
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        snap[cpu] = __atomic_load_n(&rcu_cpu[cpu].qs, __ATOMIC_ACQUIRE);
+        if (cpu != self && cpu_data[cpu].online) {
+            gic_send_sgi(cpu, IPI_RESCHEDULE);
+        }
+    }
+
+    // The calling thread is not a reader, so its own CPU is quiescent
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu == self || !cpu_data[cpu].online) {
+            continue;
+        }
+        while (__atomic_load_n(&rcu_cpu[cpu].qs, __ATOMIC_ACQUIRE) == snap[cpu]) {
+            cpu_relax();
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "arch/fpsimd.h"
+#include "arch/irq.h"
+#include "drivers/uart.h"
+#include "lib/printk.h"
+#include "lib/shell.h"
+#include "lib/stats.h"
+#include "mm/page_alloc.h"
+#include "mm/slab.h"
+#include "sched/sched.h"
+
+#define SHELL_LINE_MAX 32
+
+struct shell_cmd {
+    const char *name;
+    const char *help;
+    void (*run)(void);
+};
+
+static void shell_help(void);
+
+static const struct shell_cmd shell_cmds[] = {
+    { "help", "list the commands", shell_help },
+    { "fpsimd", "lazy FP/SIMD loads and saves per CPU", fpsimd_dump },
+    { "irqs", "interrupts taken, per IRQ and CPU", irq_stats_dump },
+    { "mm", "free pages per order and in the per-CPU caches", page_alloc_dump },
+    { "sched", "run queues, switches and steals per CPU", sched_dump },
+    { "slab", "slab caches: use, hit rate and fragmentation", kmem_cache_dump_all },
+    { "stats", "event counters per CPU (lib/stats.h)", stats_dump },
+};
+
+#define NR_SHELL_CMDS (sizeof(shell_cmds) / sizeof(shell_cmds[0]))
+
+// Only the RX interrupt touches these
+static char shell_line[SHELL_LINE_MAX + 1];
+static size_t shell_len;
+static bool shell_overflow;
+
+static void shell_help(void) {
+    for (size_t i = 0; i < NR_SHELL_CMDS; i++) {
+        printk("        %-8s %s\n", shell_cmds[i].name, shell_cmds[i].help);
+    }
+}
+
+static bool name_is(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static void shell_run(void) {
+    if (shell_overflow) {
+        LOG_WARN("shell: line longer than %u characters\n", SHELL_LINE_MAX);
+        return;
+    }
+    shell_line[shell_len] = '\0';
+    for (size_t i = 0; i < NR_SHELL_CMDS; i++) {
+        if (name_is(shell_line, shell_cmds[i].name)) {
+            shell_cmds[i].run();
+            return;
+        }
+    }
+    // Not LOG_WARN: LOG_DEFERRED would keep only the pointer to a line
+    // that the next keystroke overwrites
+    LOG_WARN_NOW("shell: unknown command \"%s\", try help\n", shell_line);
+}
+
+static void shell_byte(char c) {
+    if (c == '\r' || c == '\n') {
+        if (shell_len || shell_overflow) {
+            shell_run();
+        }
+        shell_len = 0;
+        shell_overflow = false;
+    } else if (c == '\b' || c == 0x7F) {
+        if (shell_len) {
+            shell_len--;
+        }
+    } else if (shell_len == SHELL_LINE_MAX) {
+        shell_overflow = true;
+    } else if (c >= ' ' && c <= '~') {
+        shell_line[shell_len++] = c;
+    }
+}
+
+static void shell_rx(void) {
+    const char *data;
+    size_t n;
+
+    while ((n = uart_rx_peek(&data)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            shell_byte(data[i]);
+        }
+        uart_rx_consume(n);
+    }
+}
+
+void shell_init(void) {
+    uart_set_rx_notify(shell_rx);
+}
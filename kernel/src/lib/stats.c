@@ -0,0 +1,57 @@
+#include "arch/cpu.h"
+#include "lib/printk.h"
+#include "lib/stats.h"
+
+struct stat_cpu stat_cpus[MAX_CPUS];
+
+static const char *const stat_names[NR_STATS] = {
+    [STAT_UART_TX_BYTES] = "uart_tx_bytes",
+    [STAT_UART_TX_STALLS] = "uart_tx_stalls",
+    [STAT_PRINTK] = "printk",
+    [STAT_IRQS] = "irqs",
+    [STAT_PAGE_ALLOCS] = "page_allocs",
+    [STAT_SLAB_ALLOCS] = "slab_allocs",
+    [STAT_CTX_SWITCHES] = "ctx_switches",
+    [STAT_TIMERS] = "timers",
+};
+
+// The owner keeps writing meanwhile: a relaxed load gets a value that
+// was current at some point, which is all a counter needs
+unsigned long stat_read_cpu(enum stat_id id, unsigned int cpu) {
+    return __atomic_load_n(&stat_cpus[cpu].count[id], __ATOMIC_RELAXED);
+}
+
+unsigned long stat_read(enum stat_id id) {
+    unsigned long total = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        total += stat_read_cpu(id, cpu);
+    }
+    return total;
+}
+
+void stats_dump(void) {
+    char row[LOG_RECORD_MAX];
+
+    // A core that timed out at bring-up leaves a hole in the numbering
+    size_t len = (size_t)snprintk(row, sizeof(row), "        %-14s %12s", "counter", "total");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu_data[cpu].online) {
+            len += (size_t)snprintk(row + len, sizeof(row) - len, " %9s%u", "cpu", cpu);
+        }
+    }
+    LOG_INFO("stats: event counters\n");
+    printk("%s\n", row);
+
+    for (unsigned int id = 0; id < NR_STATS; id++) {
+        len = (size_t)snprintk(row, sizeof(row), "        %-14s %12lu", stat_names[id],
+                               stat_read(id));
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpu_data[cpu].online) {
+                len += (size_t)snprintk(row + len, sizeof(row) - len, " %10lu",
+                                        stat_read_cpu(id, cpu));
+            }
+        }
+        printk("%s\n", row);
+    }
+}
@@ -1,10 +1,115 @@
+#include <stdbool.h>
+#include <arch/fpsimd.h>
+#include <arch/irq.h>
+#include <arch/psci.h>
+#include <arch/smp.h>
+#include <bench/bench.h>
+#include <drivers/gic.h>
+#include <drivers/timer.h>
 #include <drivers/uart.h>
+#include <drivers/virtio.h>
+#include <drivers/virtio_blk.h>
+#include <drivers/virtio_console.h>
+#include <lib/boottime.h>
+#include <lib/console.h>
+#include <lib/fdt.h>
+#include <lib/log.h>
 #include <lib/printk.h>
+#include <lib/shell.h>
+#include <mm/mmu.h>
+#include <mm/page_alloc.h>
+#include <profile/profile.h>
+#include <sched/ktimer.h>
+#include <sched/sched.h>
+
+#define DEMO_THREADS 6
+
+#ifdef PROFILE_BUILD
+static unsigned int demo_done;
+#endif
+
+// Busy for arg milliseconds, so there is something to preempt and steal
+static void demo_worker(void *arg) {
+    uint64_t ms = (uintptr_t)arg;
+    unsigned int first_cpu = cpu_id();
+    uint64_t until = ktime_ns() + ms * NSEC_PER_MSEC;
+
+    while (ktime_ns() < until) {
+        cpu_relax();
+    }
+    LOG_INFO("sched: %s spun %lu ms, started on cpu%u, finished on cpu%u\n",
+             current_thread()->name, ms, first_cpu, cpu_id());
+
+#ifdef PROFILE_BUILD
+    // make profile: the run ends with the last demo thread
+    if (__atomic_add_fetch(&demo_done, 1, __ATOMIC_ACQ_REL) == DEMO_THREADS) {
+        profile_stop();
+        profile_dump();
+        uart_flush();
+        psci_system_off();
+    }
+#endif
+}
 
 void kernel_main(void) {
+    bool have_dtb = fdt_index_init((const void *)dtb_address) == 0;
+    boot_mark("dtb");
+
+    uart_init();
+    boot_mark("uart");
+    gic_init();
+    boot_mark("gic");
+    timer_init();
+    ktimers_init();
+    profile_init();
+    uart_enable_irq();
+    log_init();
+    shell_init();
+    local_irq_enable();
+    boot_mark("timer+irq");
+
     LOG_INFO("Kernel initialized successfully!\n");
+    LOG_INFO("MMU %s, kernel image 0x%lx - 0x%lx\n",
+             mmu_enabled() ? "on" : "off", kernel_start_phys(), kernel_end_phys());
+    LOG_INFO("boot %lu since power-on\n", console_ring_boot());
+    console_ring_dump_prev();
+
+    if (have_dtb) {
+        fdt_index_dump();
+    } else {
+        LOG_WARN("No valid DTB at 0x%lx, using built-in defaults\n", dtb_address);
+    }
+
+    page_alloc_init();
+    boot_mark("page_alloc");
+    virtio_init();
+    virtio_console_init();
+    virtio_blk_init();
+    virtio_dump();
+    console_list_dump();
+    boot_mark("virtio");
+    sched_init();
+    boot_mark("sched");
+    smp_init();
+    boot_mark("smp");
+    boot_time_dump();
+
+#ifdef BENCH_BUILD
+    // make bench: report and power off, so QEMU exits when it is done
+    bench_run_all();
+    log_drain();
+    uart_flush();
+    psci_system_off();
+#else
+    for (unsigned int i = 0; i < DEMO_THREADS; i++) {
+        thread_create("demo", demo_worker, (void *)(uintptr_t)(20 + 10 * i));
+    }
+    fpsimd_check_start();
+
     LOG_DEBUG("Debugging information: var=%d, addr=0x%x\n", 42, 0xdeadbeef);
     LOG_WARN("This is a warning message.\n");
     LOG_ERROR("This is an error message!\n");
-    while (1) {}
+#endif
+
+    cpu_idle();
 }
@@ -0,0 +1,335 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
+#include "lib/string.h"
+#include "mm/memlayout.h"
+#include "mm/page_alloc.h"
+
+// Binary buddy allocator over the identity-mapped RAM window.
+//
+// Page index 0 is RAM_BASE, so a block of order n is always aligned to
+// 2^n pages physically. One metadata byte per page records whether the
+// page heads a free block and of which order; it lives in BSS so it needs
+// no initialisation beyond what boot.S already does. Free blocks are kept
+// on per-order doubly-linked lists threaded through the free pages
+// themselves.
+//
+// Single pages are served from a small per-CPU LIFO cache in front of the
+// buddy lists, which makes the common alloc_page()/free_page() pair O(1),
+// lock-free and keeps recently freed (cache-hot) pages on the core that
+// touched them. zone_lock is only taken to move a batch between the two.
+
+#define RAM_MAX_PAGES (RAM_MAP_SIZE >> PAGE_SHIFT)
+
+#define PG_FREE       0x80   // head of a free buddy block
+#define PG_ORDER_MASK 0x0F
+
+#define PCP_BATCH 16
+#define PCP_HIGH  64
+
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+};
+
+struct free_area {
+    struct free_block *head;
+    size_t count;
+};
+
+static uint8_t page_meta[RAM_MAX_PAGES];
+static struct free_area free_area[PAGE_MAX_ORDER];
+static size_t nr_pages;     // pages covered by page_meta
+static size_t nr_free;      // free pages, including the hot caches
+static spinlock_t zone_lock = SPINLOCK_INIT;
+
+struct pcp_cache {
+    struct free_block *head;
+    unsigned int count;
+} __cacheline_aligned;
+
+static struct pcp_cache pcp[MAX_CPUS];
+
+static inline void nr_free_add(long n) {
+    __atomic_add_fetch(&nr_free, (size_t)n, __ATOMIC_RELAXED);
+}
+
+static inline size_t page_index(const void *addr) {
+    return ((uintptr_t)addr - RAM_BASE) >> PAGE_SHIFT;
+}
+
+static inline struct free_block *page_block(size_t idx) {
+    return (struct free_block *)(RAM_BASE + (idx << PAGE_SHIFT));
+}
+
+static void free_area_add(size_t idx, unsigned int order) {
+    struct free_area *area = &free_area[order];
+    struct free_block *block = page_block(idx);
+
+    block->prev = NULL;
+    block->next = area->head;
+    if (area->head) {
+        area->head->prev = block;
+    }
+    area->head = block;
+    area->count++;
+    page_meta[idx] = PG_FREE | order;
+}
+
+static void free_area_del(size_t idx, unsigned int order) {
+    struct free_area *area = &free_area[order];
+    struct free_block *block = page_block(idx);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        area->head = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    area->count--;
+    page_meta[idx] = 0;
+}
+
+static void *buddy_alloc(unsigned int order) {
+    unsigned int o = order;
+
+    while (o < PAGE_MAX_ORDER && !free_area[o].head) {
+        o++;
+    }
+    if (o == PAGE_MAX_ORDER) {
+        return NULL;
+    }
+
+    size_t idx = page_index(free_area[o].head);
+    free_area_del(idx, o);
+
+    // Split down to the requested order, returning upper halves
+    while (o > order) {
+        o--;
+        free_area_add(idx + ((size_t)1 << o), o);
+    }
+
+    return page_block(idx);
+}
+
+static void buddy_free(size_t idx, unsigned int order) {
+    while (order < PAGE_MAX_ORDER - 1) {
+        size_t buddy = idx ^ ((size_t)1 << order);
+
+        if (buddy >= nr_pages || page_meta[buddy] != (PG_FREE | order)) {
+            break;
+        }
+        free_area_del(buddy, order);
+        idx &= ~((size_t)1 << order);
+        order++;
+    }
+    free_area_add(idx, order);
+}
+
+// Seed [start, end) (page indexes) as the largest aligned blocks that fit
+static void free_range(size_t start, size_t end) {
+    while (start < end) {
+        unsigned int order = PAGE_MAX_ORDER - 1;
+
+        while ((start & (((size_t)1 << order) - 1)) ||
+               start + ((size_t)1 << order) > end) {
+            order--;
+        }
+        free_area_add(start, order);
+        nr_free += (size_t)1 << order;
+        start += (size_t)1 << order;
+    }
+}
+
+static bool dtb_memory_range(uintptr_t *base, uintptr_t *end) {
+    int node = fdt_find_node("/memory");
+    uint64_t addr, size;
+
+    if (node < 0 || !fdt_get_reg(node, 0, &addr, &size)) {
+        return false;
+    }
+
+    *base = (uintptr_t)addr;
+    *end = (uintptr_t)(addr + size);
+    return true;
+}
+
+void page_alloc_init(void) {
+    const void *dtb = fdt_blob();
+    uintptr_t mem_base, mem_end;
+
+    if (!dtb_memory_range(&mem_base, &mem_end)) {
+        LOG_WARN("mm: no usable /memory node, assuming %lu MiB\n",
+                 RAM_DEFAULT_SIZE >> 20);
+        mem_base = RAM_BASE;
+        mem_end = RAM_BASE + RAM_DEFAULT_SIZE;
+    }
+
+    if (mem_end > RAM_BASE + RAM_MAP_SIZE) {
+        LOG_WARN("mm: only the first %lu MiB of RAM are mapped\n",
+                 RAM_MAP_SIZE >> 20);
+        mem_end = RAM_BASE + RAM_MAP_SIZE;
+    }
+
+    uintptr_t start = PAGE_ALIGN(kernel_end_phys());
+    uintptr_t end = PAGE_ALIGN_DOWN(mem_end);
+
+    if (mem_base > start) {
+        start = PAGE_ALIGN(mem_base);
+    }
+    nr_pages = (end - RAM_BASE) >> PAGE_SHIFT;
+
+    // Keep the DTB itself out of the free pool
+    uintptr_t dtb_start = end, dtb_end = end;
+    if (dtb) {
+        dtb_start = PAGE_ALIGN_DOWN((uintptr_t)dtb);
+        dtb_end = PAGE_ALIGN((uintptr_t)dtb + fdt_totalsize(dtb));
+    }
+
+    if (dtb_end <= start || dtb_start >= end) {
+        free_range(page_index((void *)start), page_index((void *)end));
+    } else {
+        if (dtb_start > start) {
+            free_range(page_index((void *)start), page_index((void *)dtb_start));
+        }
+        if (dtb_end < end) {
+            free_range(page_index((void *)dtb_end), page_index((void *)end));
+        }
+    }
+
+    LOG_INFO("mm: RAM 0x%lx - 0x%lx, %lu KiB free from 0x%lx\n",
+             mem_base, mem_end, (nr_free << PAGE_SHIFT) >> 10, start);
+}
+
+void *alloc_pages(unsigned int order) {
+    if (order >= PAGE_MAX_ORDER) {
+        return NULL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+    void *block = buddy_alloc(order);
+    spin_unlock_irqrestore(&zone_lock, flags);
+
+    if (block) {
+        stat_inc(STAT_PAGE_ALLOCS);
+        nr_free_add(-(1L << order));
+    }
+    return block;
+}
+
+void free_pages(void *addr, unsigned int order) {
+    if (!addr) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&zone_lock);
+    buddy_free(page_index(addr), order);
+    spin_unlock_irqrestore(&zone_lock, flags);
+
+    nr_free_add(1L << order);
+}
+
+void *alloc_page(void) {
+    unsigned long flags = local_irq_save();
+    struct pcp_cache *cache = &pcp[cpu_id()];
+
+    if (!cache->head) {
+        spin_lock(&zone_lock);
+        while (cache->count < PCP_BATCH) {
+            struct free_block *block = buddy_alloc(0);
+            if (!block) {
+                break;
+            }
+            block->next = cache->head;
+            cache->head = block;
+            cache->count++;
+        }
+        spin_unlock(&zone_lock);
+    }
+
+    struct free_block *block = cache->head;
+    if (block) {
+        cache->head = block->next;
+        cache->count--;
+        stat_inc(STAT_PAGE_ALLOCS);
+    }
+
+    local_irq_restore(flags);
+
+    if (block) {
+        nr_free_add(-1);
+    }
+    return block;
+}
+
+void free_page(void *addr) {
+    if (!addr) {
+        return;
+    }
+
+    unsigned long flags = local_irq_save();
+    struct pcp_cache *cache = &pcp[cpu_id()];
+    struct free_block *block = addr;
+
+    block->next = cache->head;
+    cache->head = block;
+    cache->count++;
+
+    // Give a batch back to the buddy lists so they can coalesce
+    if (cache->count > PCP_HIGH) {
+        spin_lock(&zone_lock);
+        while (cache->count > PCP_HIGH - PCP_BATCH) {
+            block = cache->head;
+            cache->head = block->next;
+            cache->count--;
+            buddy_free(page_index(block), 0);
+        }
+        spin_unlock(&zone_lock);
+    }
+
+    local_irq_restore(flags);
+    nr_free_add(1);
+}
+
+void *alloc_pages_zeroed(unsigned int order) {
+    void *block = alloc_pages(order);
+
+    if (block) {
+        memset(block, 0, PAGE_SIZE << order);
+    }
+    return block;
+}
+
+void *alloc_page_zeroed(void) {
+    void *page = alloc_page();
+
+    if (page) {
+        memset(page, 0, PAGE_SIZE);
+    }
+    return page;
+}
+
+size_t page_alloc_free_count(void) {
+    return __atomic_load_n(&nr_free, __ATOMIC_RELAXED);
+}
+
+void page_alloc_dump(void) {
+    unsigned int cached = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cached += pcp[cpu].count;
+    }
+    LOG_INFO("mm: %lu free pages (%u in hot caches)\n", page_alloc_free_count(), cached);
+    for (unsigned int order = 0; order < PAGE_MAX_ORDER; order++) {
+        if (free_area[order].count) {
+            printk("        order %2u: %lu blocks\n", order, free_area[order].count);
+        }
+    }
+}
@@ -0,0 +1,322 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "lib/printk.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
+#include "mm/memlayout.h"
+#include "mm/page_alloc.h"
+#include "mm/slab.h"
+
+// Object caches in the style of Bonwick's slab allocator.
+//
+// Each slab is a naturally aligned block of 2^order pages from the page
+// allocator with a struct slab header at its start, so the slab owning an
+// object is found by masking the object address. Free objects inside a
+// slab are chained through their first word.
+//
+// In front of the slabs, every CPU has a magazine: a small stack of
+// ready-to-use objects. Allocation and free only touch the local magazine
+// with IRQs masked; the cache lock is taken only to refill an empty
+// magazine or to flush a full one, MAG_BATCH objects at a time.
+
+#define KMEM_MAX_CACHES 16
+#define MAG_SIZE        32
+#define MAG_BATCH       (MAG_SIZE / 2)
+#define SLAB_MIN_OBJS   8
+#define SLAB_MAX_ORDER  3
+#define SLAB_MAX_EMPTY  1   // empty slabs kept before returning pages
+
+struct slab {
+    struct slab *next;
+    struct slab *prev;
+    void *freelist;
+    unsigned int inuse;
+};
+
+struct slab_list {
+    struct slab *head;
+    size_t count;
+};
+
+struct kmem_magazine {
+    unsigned int rounds;
+    unsigned long hits;     // allocations served from the magazine
+    unsigned long misses;   // allocations that had to refill it
+    unsigned long flushes;  // frees that found it full
+    void *objs[MAG_SIZE];
+} __cacheline_aligned;
+
+struct kmem_cache {
+    struct kmem_magazine mag[MAX_CPUS];
+    const char *name;
+    size_t obj_size;        // requested size
+    size_t stride;          // size rounded up to the alignment
+    unsigned int order;
+    unsigned int objs_per_slab;
+    size_t first_obj;       // offset of object 0 from the slab start
+
+    spinlock_t lock;
+    struct slab_list partial;
+    struct slab_list full;
+    struct slab_list empty;
+    size_t nr_slabs;
+    size_t slab_inuse;      // objects out of slabs (users + magazines)
+    unsigned long grows;
+    unsigned long shrinks;
+};
+
+static struct kmem_cache caches[KMEM_MAX_CACHES];
+static unsigned int nr_caches;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+static void slab_list_add(struct slab_list *list, struct slab *slab) {
+    slab->prev = NULL;
+    slab->next = list->head;
+    if (list->head) {
+        list->head->prev = slab;
+    }
+    list->head = slab;
+    list->count++;
+}
+
+static void slab_list_del(struct slab_list *list, struct slab *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        list->head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    list->count--;
+}
+
+static inline size_t slab_bytes(const struct kmem_cache *cache) {
+    return PAGE_SIZE << cache->order;
+}
+
+static inline struct slab *obj_to_slab(const struct kmem_cache *cache, void *obj) {
+    return (struct slab *)((uintptr_t)obj & ~(slab_bytes(cache) - 1));
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align) {
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+    if (size == 0 || (align & (align - 1))) {
+        return NULL;
+    }
+
+    size_t stride = (size + align - 1) & ~(align - 1);
+    size_t first = (sizeof(struct slab) + align - 1) & ~(align - 1);
+    unsigned int order = 0;
+
+    while (order < SLAB_MAX_ORDER &&
+           ((PAGE_SIZE << order) - first) / stride < SLAB_MIN_OBJS) {
+        order++;
+    }
+    if (((PAGE_SIZE << order) - first) / stride == 0) {
+        LOG_ERROR("slab: %s: object size %lu too large\n", name, size);
+        return NULL;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&caches_lock);
+    struct kmem_cache *cache = NULL;
+    if (nr_caches < KMEM_MAX_CACHES) {
+        cache = &caches[nr_caches++];
+    }
+    spin_unlock_irqrestore(&caches_lock, flags);
+
+    if (!cache) {
+        LOG_ERROR("slab: no room for cache %s\n", name);
+        return NULL;
+    }
+
+    cache->name = name;
+    cache->obj_size = size;
+    cache->stride = stride;
+    cache->order = order;
+    cache->first_obj = first;
+    cache->objs_per_slab = ((PAGE_SIZE << order) - first) / stride;
+    return cache;
+}
+
+// Carve a fresh slab into objects. Called with the cache lock held.
+static struct slab *slab_grow(struct kmem_cache *cache) {
+    struct slab *slab = (cache->order == 0) ? alloc_page() : alloc_pages(cache->order);
+    if (!slab) {
+        return NULL;
+    }
+
+    char *obj = (char *)slab + cache->first_obj;
+    void *freelist = NULL;
+
+    // Chain back to front so allocation walks the slab in address order
+    for (unsigned int i = cache->objs_per_slab; i > 0; i--) {
+        void **link = (void **)(obj + (i - 1) * cache->stride);
+        *link = freelist;
+        freelist = link;
+    }
+
+    slab->freelist = freelist;
+    slab->inuse = 0;
+    cache->nr_slabs++;
+    cache->grows++;
+    return slab;
+}
+
+static void slab_release(struct kmem_cache *cache, struct slab *slab) {
+    cache->nr_slabs--;
+    cache->shrinks++;
+    if (cache->order == 0) {
+        free_page(slab);
+    } else {
+        free_pages(slab, cache->order);
+    }
+}
+
+// Move up to count objects from the slabs into objs[]. Lock held.
+static unsigned int slab_take(struct kmem_cache *cache, void **objs, unsigned int count) {
+    unsigned int n = 0;
+
+    while (n < count) {
+        struct slab *slab = cache->partial.head;
+
+        if (!slab) {
+            slab = cache->empty.head;
+            if (slab) {
+                slab_list_del(&cache->empty, slab);
+            } else {
+                slab = slab_grow(cache);
+                if (!slab) {
+                    break;
+                }
+            }
+            slab_list_add(&cache->partial, slab);
+        }
+
+        while (n < count && slab->freelist) {
+            void **obj = slab->freelist;
+            slab->freelist = *obj;
+            slab->inuse++;
+            objs[n++] = obj;
+        }
+
+        if (!slab->freelist) {
+            slab_list_del(&cache->partial, slab);
+            slab_list_add(&cache->full, slab);
+        }
+    }
+
+    cache->slab_inuse += n;
+    return n;
+}
+
+// Return objects to their slabs. Lock held.
+static void slab_put(struct kmem_cache *cache, void **objs, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        struct slab *slab = obj_to_slab(cache, objs[i]);
+        bool was_full = slab->freelist == NULL;
+
+        *(void **)objs[i] = slab->freelist;
+        slab->freelist = objs[i];
+        slab->inuse--;
+
+        if (was_full) {
+            slab_list_del(&cache->full, slab);
+            slab_list_add(&cache->partial, slab);
+        }
+
+        if (slab->inuse == 0) {
+            slab_list_del(&cache->partial, slab);
+            if (cache->empty.count < SLAB_MAX_EMPTY) {
+                slab_list_add(&cache->empty, slab);
+            } else {
+                slab_release(cache, slab);
+            }
+        }
+    }
+
+    cache->slab_inuse -= count;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    unsigned long flags = local_irq_save();
+    struct kmem_magazine *mag = &cache->mag[cpu_id()];
+    void *obj = NULL;
+
+    if (mag->rounds > 0) {
+        mag->hits++;
+    } else {
+        mag->misses++;
+        spin_lock(&cache->lock);
+        mag->rounds = slab_take(cache, mag->objs, MAG_BATCH);
+        spin_unlock(&cache->lock);
+    }
+
+    if (mag->rounds > 0) {
+        obj = mag->objs[--mag->rounds];
+        stat_inc(STAT_SLAB_ALLOCS);
+    }
+
+    local_irq_restore(flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+
+    unsigned long flags = local_irq_save();
+    struct kmem_magazine *mag = &cache->mag[cpu_id()];
+
+    if (mag->rounds == MAG_SIZE) {
+        // Flush the older half; the most recently freed (cache-hot)
+        // objects stay local.
+        mag->flushes++;
+        spin_lock(&cache->lock);
+        slab_put(cache, mag->objs, MAG_BATCH);
+        spin_unlock(&cache->lock);
+
+        for (unsigned int i = MAG_BATCH; i < MAG_SIZE; i++) {
+            mag->objs[i - MAG_BATCH] = mag->objs[i];
+        }
+        mag->rounds -= MAG_BATCH;
+    }
+
+    mag->objs[mag->rounds++] = obj;
+    local_irq_restore(flags);
+}
+
+void kmem_cache_dump(const struct kmem_cache *cache) {
+    unsigned long hits = 0, misses = 0, flushes = 0, cached = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        hits += cache->mag[cpu].hits;
+        misses += cache->mag[cpu].misses;
+        flushes += cache->mag[cpu].flushes;
+        cached += cache->mag[cpu].rounds;
+    }
+
+    size_t capacity = cache->nr_slabs * cache->objs_per_slab;
+    size_t live = cache->slab_inuse - cached;
+    size_t slack = cache->nr_slabs * slab_bytes(cache) - live * cache->obj_size;
+    unsigned long total = hits + misses;
+
+    printk("        %s: %lu/%lu objs, %lu slabs (%lu partial, %lu empty), "
+           "hit %lu%%, miss %lu, flush %lu, frag %lu%%\n",
+           cache->name, live, capacity, cache->nr_slabs,
+           cache->partial.count, cache->empty.count,
+           total ? hits * 100 / total : 0, misses, flushes,
+           cache->nr_slabs ? slack * 100 / (cache->nr_slabs * slab_bytes(cache)) : 0);
+}
+
+void kmem_cache_dump_all(void) {
+    LOG_INFO("slab: %u caches\n", nr_caches);
+    for (unsigned int i = 0; i < nr_caches; i++) {
+        kmem_cache_dump(&caches[i]);
+    }
+}
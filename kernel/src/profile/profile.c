@@ -0,0 +1,225 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/exception.h"
+#include "arch/irq.h"
+#include "arch/sysreg.h"
+#include "drivers/gic.h"
+#include "lib/binchan.h"
+#include "lib/fdt.h"
+#include "lib/printk.h"
+#include "lib/string.h"
+#include "mm/memlayout.h"
+#include "profile/profile.h"
+#include "sched/sched.h"
+
+// The cycle counter is preloaded with -PROFILE_PERIOD, so it overflows
+// (and raises the PMU PPI) after that many cycles. The handler takes the
+// PC from the exception frame and follows the frame-pointer chain, which
+// the profile build keeps with -fno-omit-frame-pointer:
+//
+//   fp ──> [ caller's fp | return address ]
+//
+// Addresses are stored as 32-bit offsets from the kernel image base, so a
+// full-depth sample is 32 bytes.
+//
+// The PMU interrupt is an ordinary IRQ: code running with IRQs masked is
+// never sampled, and its time is charged to the instruction where IRQs
+// are unmasked again (local_irq_restore(), the eret after a handler).
+
+#define PMU_DEFAULT_IRQ 23      // PPI 7 on QEMU virt
+
+#define PMCR_E      (1UL << 0)  // enable counters
+#define PMCR_LC     (1UL << 6)  // overflow at 64 bits, not 32
+#define PMU_CYCLE   (1UL << 31) // cycle counter bit in PMCNTEN/PMINTEN/PMOVS
+
+#define ID_AA64DFR0_PMUVER(x) (((x) >> 8) & 0xF)
+#define PMUVER_IMPDEF         0xF
+
+#define PROFILE_STACK_SIZE (PAGE_SIZE << THREAD_STACK_ORDER)
+
+struct profile_sample {
+    uint32_t pc[PROFILE_DEPTH];     // 0 ends a short backtrace
+};
+
+struct profile_buf {
+    unsigned int count;             // published with release
+    unsigned int dropped;
+    struct profile_sample samples[PROFILE_SAMPLES];
+} __cacheline_aligned;
+
+struct profile_header {
+    uint32_t depth;
+    uint32_t period;
+    uint64_t base;
+    uint32_t samples;
+    uint32_t dropped;
+} __attribute__((packed));
+
+static struct profile_buf profile_bufs[MAX_CPUS];
+static unsigned int pmu_irq = PMU_DEFAULT_IRQ;
+static bool profile_enabled;
+static bool profile_stopped;
+
+static inline void pmu_arm(void) {
+    write_sysreg(pmccntr_el0, -(uint64_t)PROFILE_PERIOD);
+}
+
+static void pmu_start(void) {
+    write_sysreg(pmccfiltr_el0, 0);     // count at EL0 and EL1
+    write_sysreg(pmovsclr_el0, PMU_CYCLE);
+    pmu_arm();
+    write_sysreg(pmintenset_el1, PMU_CYCLE);
+    write_sysreg(pmcntenset_el0, PMU_CYCLE);
+    write_sysreg(pmcr_el0, read_sysreg(pmcr_el0) | PMCR_E | PMCR_LC);
+    isb();
+}
+
+static void pmu_stop(void) {
+    write_sysreg(pmcntenclr_el0, PMU_CYCLE);
+    write_sysreg(pmintenclr_el1, PMU_CYCLE);
+    isb();
+}
+
+// PC and return addresses, as offsets from the image base. The chain is
+// only followed upwards within one kernel stack above the exception
+// frame, so a corrupt or missing frame pointer ends the walk.
+static unsigned int profile_unwind(uint32_t *out, const struct exception_frame *frame) {
+    uintptr_t base = kernel_start_phys();
+    uintptr_t end = kernel_end_phys();
+    uintptr_t low = (uintptr_t)frame;
+    uintptr_t high = low + PROFILE_STACK_SIZE;
+    uintptr_t fp = frame->regs[29];
+    unsigned int n = 0;
+
+    out[n++] = (uint32_t)(frame->elr - base);
+
+    while (n < PROFILE_DEPTH && fp > low && fp + 16 <= high && !(fp & 7)) {
+        const uint64_t *record = (const uint64_t *)fp;
+        uintptr_t lr = record[1];
+
+        if (lr <= base || lr >= end) {
+            break;
+        }
+        out[n++] = (uint32_t)(lr - base);
+        if (record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+    return n;
+}
+
+static void profile_irq(unsigned int irq, void *arg) {
+    (void)irq;
+    (void)arg;
+
+    uint64_t overflow = read_sysreg(pmovsclr_el0);
+    write_sysreg(pmovsclr_el0, overflow);
+    if (!(overflow & PMU_CYCLE)) {
+        return;
+    }
+
+    if (__atomic_load_n(&profile_stopped, __ATOMIC_ACQUIRE)) {
+        pmu_stop();
+        return;
+    }
+    pmu_arm();
+
+    const struct exception_frame *frame = irq_frame();
+    struct profile_buf *buf = &profile_bufs[cpu_id()];
+    unsigned int count = buf->count;
+
+    if (!frame || count == PROFILE_SAMPLES) {
+        buf->dropped++;
+        return;
+    }
+
+    struct profile_sample *sample = &buf->samples[count];
+    unsigned int n = profile_unwind(sample->pc, frame);
+    if (n < PROFILE_DEPTH) {
+        sample->pc[n] = 0;
+    }
+    __atomic_store_n(&buf->count, count + 1, __ATOMIC_RELEASE);
+}
+
+void profile_init(void) {
+    uint64_t ver = ID_AA64DFR0_PMUVER(read_sysreg(id_aa64dfr0_el1));
+
+    if (ver == 0 || ver == PMUVER_IMPDEF) {
+        LOG_WARN("profile: no PMUv3, not sampling\n");
+        return;
+    }
+
+    int node = fdt_find_compatible(-1, "arm,armv8-pmuv3");
+    if (node >= 0) {
+        int irq = fdt_get_irq(node, 0);
+        if (irq >= 0) {
+            pmu_irq = (unsigned int)irq;
+        }
+    }
+
+    if (irq_register(pmu_irq, profile_irq, NULL) < 0) {
+        return;
+    }
+    profile_enabled = true;
+    pmu_start();
+    LOG_INFO("profile: sampling every %u cycles, PMU IRQ %u\n", PROFILE_PERIOD, pmu_irq);
+}
+
+void profile_cpu_init(void) {
+    if (!profile_enabled) {
+        return;
+    }
+    gic_enable_irq(pmu_irq);
+    pmu_start();
+}
+
+void profile_stop(void) {
+    if (!profile_enabled) {
+        return;
+    }
+    // Other CPUs stop their counters at their next overflow
+    __atomic_store_n(&profile_stopped, true, __ATOMIC_RELEASE);
+    pmu_stop();
+}
+
+void profile_dump(void) {
+    struct profile_header header = {
+        .depth = PROFILE_DEPTH,
+        .period = PROFILE_PERIOD,
+        .base = kernel_start_phys(),
+    };
+    unsigned int count[MAX_CPUS];
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        count[cpu] = __atomic_load_n(&profile_bufs[cpu].count, __ATOMIC_ACQUIRE);
+        header.samples += count[cpu];
+        header.dropped += profile_bufs[cpu].dropped;
+    }
+
+    LOG_INFO("profile: %u samples, %u dropped\n", header.samples, header.dropped);
+    log_drain();
+
+    if (!binchan_open(BINCHAN_PROFILE, 0)) {
+        LOG_WARN("profile: binary channel busy\n");
+        return;
+    }
+    binchan_write(&header, sizeof(header));
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (unsigned int i = 0; i < count[cpu]; i++) {
+            const struct profile_sample *sample = &profile_bufs[cpu].samples[i];
+            uint8_t record[2 + PROFILE_DEPTH * sizeof(uint32_t)];
+            unsigned int n = 0;
+
+            while (n < PROFILE_DEPTH && (n == 0 || sample->pc[n])) {
+                n++;
+            }
+            record[0] = (uint8_t)cpu;
+            record[1] = (uint8_t)n;
+            memcpy(&record[2], sample->pc, n * sizeof(uint32_t));  // little-endian
+            binchan_write(record, 2 + n * sizeof(uint32_t));
+        }
+    }
+    binchan_close();
+}
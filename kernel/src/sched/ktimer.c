@@ -0,0 +1,293 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arch/cpu.h"
+#include "arch/irq.h"
+#include "drivers/timer.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
+#include "sched/ktimer.h"
+
+// Hierarchical timer wheel, one per CPU. Time is counted in units of
+// 2^20 ns; level n has 64 slots, each 8^n units wide:
+//
+//   level 0   64 slots x 1 unit       the next      64 units (~67 ms)
+//   level 1   64 slots x 8 units      the next     512 units (~537 ms)
+//   ...
+//   level 5   64 slots x 32768 units  the next 2097152 units (~36 min)
+//
+// A timer goes into the lowest level that reaches its deadline, rounded
+// up to that level's slot width, and stays there: there is no cascading
+// into lower levels, so adding and cancelling are list operations. The
+// price is precision, at most one slot width late. Level n + 1 is only
+// used past 63 slots of level n, so that is under 8/63 of the distance.
+//
+// clk is the next unit to process. At unit c, level n processes its
+// slot for c if c is a multiple of its width. Each level keeps a bitmap
+// of non-empty slots, so the earliest unit with work is found with one
+// count of trailing zeros per level; the interrupt jumps straight there
+// instead of stepping through empty units, and the hardware timer is only
+// ever programmed for that unit.
+
+#define WHEEL_UNIT_SHIFT    20
+#define WHEEL_LVL_BITS      6
+#define WHEEL_LVL_SIZE      (1U << WHEEL_LVL_BITS)
+#define WHEEL_LVL_MASK      (WHEEL_LVL_SIZE - 1)
+#define WHEEL_LVL_CLK_SHIFT 3
+#define WHEEL_LEVELS        6
+#define WHEEL_NONE          UINT64_MAX
+
+#define LVL_SHIFT(lvl)      ((lvl) * WHEEL_LVL_CLK_SHIFT)
+
+struct timer_wheel {
+    spinlock_t lock;
+    uint64_t clk;                       // next unit to process
+    uint64_t armed;                     // unit the hardware is set for
+    uint64_t pending[WHEEL_LEVELS];     // bit per non-empty slot
+    struct ktimer *slots[WHEEL_LEVELS][WHEEL_LVL_SIZE];
+} __cacheline_aligned;
+
+static struct timer_wheel wheels[MAX_CPUS];
+
+// Rounded up, so a timer never fires before its deadline
+static inline uint64_t ns_to_units(uint64_t ns) {
+    return (ns >> WHEEL_UNIT_SHIFT) + ((ns & ((1ULL << WHEEL_UNIT_SHIFT) - 1)) != 0);
+}
+
+static void timer_unlink(struct ktimer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    __atomic_store_n(&timer->pprev, NULL, __ATOMIC_RELAXED);
+}
+
+// Lock held
+static void wheel_enqueue(struct timer_wheel *w, struct ktimer *timer) {
+    uint64_t expires = timer->expires < w->clk ? w->clk : timer->expires;
+    unsigned int lvl;
+    uint64_t pos;
+
+    for (lvl = 0;; lvl++) {
+        unsigned int shift = LVL_SHIFT(lvl);
+        uint64_t round = (1ULL << shift) - 1;
+
+        // Slots from the next one to come up at this level: the same
+        // start as wheel_next(), so all 64 of them are usable
+        uint64_t first = (w->clk + round) >> shift;
+        pos = (expires + round) >> shift;
+        if (pos - first < WHEEL_LVL_SIZE) {
+            break;
+        }
+        if (lvl == WHEEL_LEVELS - 1) {
+            // Beyond the wheel: park it in the last slot, which puts it
+            // back when that comes round
+            pos = first + WHEEL_LVL_SIZE - 1;
+            break;
+        }
+    }
+
+    timer->slot = lvl * WHEEL_LVL_SIZE + (pos & WHEEL_LVL_MASK);
+    struct ktimer **slot = &w->slots[lvl][pos & WHEEL_LVL_MASK];
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    *slot = timer;
+    __atomic_store_n(&timer->pprev, slot, __ATOMIC_RELAXED);
+    w->pending[lvl] |= 1ULL << (pos & WHEEL_LVL_MASK);
+}
+
+// The first unit at or after clk with a non-empty slot; lock held
+static uint64_t wheel_next(const struct timer_wheel *w) {
+    uint64_t next = WHEEL_NONE;
+
+    for (unsigned int lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        uint64_t bits = w->pending[lvl];
+        if (!bits) {
+            continue;
+        }
+
+        // Slots in the order they come up, starting at clk
+        unsigned int shift = LVL_SHIFT(lvl);
+        uint64_t pos = (w->clk + (1ULL << shift) - 1) >> shift;
+        unsigned int start = pos & WHEEL_LVL_MASK;
+        uint64_t ahead = start ? (bits >> start) | (bits << (WHEEL_LVL_SIZE - start)) : bits;
+        uint64_t unit = (pos + __builtin_ctzl(ahead)) << shift;
+
+        if (unit < next) {
+            next = unit;
+        }
+    }
+    return next;
+}
+
+// Move clk up to now without passing a pending slot, so a new timer is
+// placed relative to the current time even after a long idle stretch
+static void wheel_forward(struct timer_wheel *w, uint64_t now) {
+    uint64_t next = wheel_next(w);
+    uint64_t to = now < next ? now : next;
+
+    if (to > w->clk) {
+        w->clk = to;
+    }
+}
+
+// Only for this CPU's wheel: the comparator is banked per core
+static void wheel_program(struct timer_wheel *w) {
+    uint64_t next = wheel_next(w);
+
+    if (next == w->armed) {
+        return;
+    }
+    w->armed = next;
+    if (next == WHEEL_NONE) {
+        timer_cancel();
+    } else {
+        timer_arm(next << WHEEL_UNIT_SHIFT);
+    }
+}
+
+// Run every slot that comes up at unit. They are spliced into one local
+// list and clk moves past unit first, so a callback that adds a timer
+// sees this unit as done. The lock is dropped around each callback, which
+// may add or cancel timers, even ones still on the local list: their
+// pprev points into it.
+static void wheel_run(struct timer_wheel *w, uint64_t unit) {
+    struct ktimer *head = NULL;
+
+    for (unsigned int lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        unsigned int shift = LVL_SHIFT(lvl);
+        if (unit & ((1ULL << shift) - 1)) {
+            break;
+        }
+
+        unsigned int idx = (unit >> shift) & WHEEL_LVL_MASK;
+        struct ktimer *list = w->slots[lvl][idx];
+        if (!list) {
+            continue;
+        }
+        w->slots[lvl][idx] = NULL;
+        w->pending[lvl] &= ~(1ULL << idx);
+
+        struct ktimer *tail = list;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        tail->next = head;
+        if (head) {
+            head->pprev = &tail->next;
+        }
+        head = list;
+    }
+
+    w->clk = unit + 1;
+    if (!head) {
+        return;
+    }
+    head->pprev = &head;
+
+    struct ktimer *timer;
+    while ((timer = head)) {
+        timer_unlink(timer);
+        if (timer->expires > unit) {
+            wheel_enqueue(w, timer);        // parked beyond the wheel
+            continue;
+        }
+
+        stat_inc(STAT_TIMERS);
+        spin_unlock(&w->lock);
+        timer->fn(timer->arg);
+        spin_lock(&w->lock);
+    }
+}
+
+static void ktimer_irq(void) {
+    struct timer_wheel *w = &wheels[cpu_id()];
+    uint64_t now = ktime_ns() >> WHEEL_UNIT_SHIFT;
+
+    spin_lock(&w->lock);
+    w->armed = WHEEL_NONE;      // the interrupt has masked the timer
+
+    for (;;) {
+        uint64_t next = wheel_next(w);
+        if (next > now) {
+            break;
+        }
+        wheel_run(w, next);
+    }
+    if (w->clk <= now) {
+        w->clk = now + 1;
+    }
+
+    wheel_program(w);
+    spin_unlock(&w->lock);
+}
+
+void ktimers_init(void) {
+    uint64_t now = ktime_ns() >> WHEEL_UNIT_SHIFT;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        wheels[cpu].clk = now;
+        wheels[cpu].armed = WHEEL_NONE;
+    }
+    timer_set_handler(ktimer_irq);
+}
+
+void ktimer_init(struct ktimer *timer, ktimer_fn_t fn, void *arg) {
+    *timer = (struct ktimer)KTIMER_INIT(fn, arg);
+}
+
+void ktimer_add(struct ktimer *timer, uint64_t deadline_ns) {
+    ktimer_cancel(timer);
+
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = cpu_id();
+    struct timer_wheel *w = &wheels[cpu];
+
+    spin_lock(&w->lock);
+    wheel_forward(w, ktime_ns() >> WHEEL_UNIT_SHIFT);
+    timer->cpu = cpu;
+    timer->expires = ns_to_units(deadline_ns);
+    wheel_enqueue(w, timer);
+    wheel_program(w);
+    spin_unlock(&w->lock);
+
+    local_irq_restore(flags);
+}
+
+void ktimer_add_after(struct ktimer *timer, uint64_t delta_ns) {
+    ktimer_add(timer, ktime_ns() + delta_ns);
+}
+
+bool ktimer_cancel(struct ktimer *timer) {
+    if (!ktimer_pending(timer)) {
+        return false;
+    }
+
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = timer->cpu;
+    struct timer_wheel *w = &wheels[cpu];
+    bool pending;
+
+    spin_lock(&w->lock);
+    pending = timer->pprev != NULL;
+    if (pending) {
+        unsigned int lvl = timer->slot / WHEEL_LVL_SIZE;
+        unsigned int idx = timer->slot & WHEEL_LVL_MASK;
+
+        // wheel_run() may hold it on its local list instead, with the
+        // slot already empty and its bit clear
+        timer_unlink(timer);
+        if (!w->slots[lvl][idx]) {
+            w->pending[lvl] &= ~(1ULL << idx);
+        }
+        if (cpu == cpu_id()) {
+            wheel_program(w);
+        }
+    }
+    spin_unlock(&w->lock);
+
+    local_irq_restore(flags);
+    return pending;
+}
@@ -0,0 +1,318 @@
+#include <stddef.h>
+#include "arch/cpu.h"
+#include "arch/fpsimd.h"
+#include "arch/irq.h"
+#include "drivers/gic.h"
+#include "lib/printk.h"
+#include "lib/rcu.h"
+#include "lib/spinlock.h"
+#include "lib/stats.h"
+#include "lib/string.h"
+#include "mm/memlayout.h"
+#include "mm/page_alloc.h"
+#include "mm/slab.h"
+#include "sched/ktimer.h"
+#include "sched/sched.h"
+
+// Every CPU has a FIFO run queue of ready threads and an idle thread that
+// runs when the queue is empty. schedule() puts the current thread at the
+// tail, takes the head, and when the local queue is empty steals the head
+// of the busiest other queue:
+//
+//   cpu0 rq: [B] -> [C] -> [D]        cpu1 rq: (empty)
+//                                     cpu1 idle: schedule()
+//   cpu0 rq: [C] -> [D]                 steals B from cpu0
+//
+// A thread that was just put back on a queue keeps on_cpu set until its
+// CPU has finished switching away from it, so nobody can steal it while
+// its registers are still being saved.
+
+struct runqueue {
+    spinlock_t lock;
+    struct thread *head;
+    struct thread *tail;
+    unsigned int nr_ready;
+    bool online;
+    volatile bool need_resched;
+    struct thread *curr;
+    struct ktimer slice;            // preempts curr when it runs out
+    unsigned long switches;
+    unsigned long steals;
+    struct thread idle;
+} __cacheline_aligned;
+
+_Static_assert(offsetof(struct thread, ctx) == THREAD_CPU_CONTEXT,
+               "switch.S expects the context at THREAD_CPU_CONTEXT");
+_Static_assert(offsetof(struct fpsimd_state, fpsr) == 512,
+               "fpsimd.S expects FPSR right after the V registers");
+
+static struct runqueue runqueues[MAX_CPUS];
+static struct kmem_cache *thread_cache;
+static unsigned int next_thread_id = 1;
+
+struct thread *cpu_switch_to(struct thread *prev, struct thread *next);
+void thread_start(void);
+
+static inline struct runqueue *this_rq(void) {
+    return &runqueues[cpu_id()];
+}
+
+// Queue operations: lock held
+static void rq_push(struct runqueue *rq, struct thread *thread) {
+    thread->next = NULL;
+    if (rq->tail) {
+        rq->tail->next = thread;
+    } else {
+        rq->head = thread;
+    }
+    rq->tail = thread;
+    rq->nr_ready++;
+}
+
+static struct thread *rq_pop(struct runqueue *rq) {
+    struct thread *thread = rq->head;
+
+    if (thread) {
+        rq->head = thread->next;
+        if (!rq->head) {
+            rq->tail = NULL;
+        }
+        rq->nr_ready--;
+    }
+    return thread;
+}
+
+static void sched_slice_end(void *arg) {
+    struct runqueue *rq = arg;
+    rq->need_resched = true;
+}
+
+static void rq_init(unsigned int cpu) {
+    struct runqueue *rq = &runqueues[cpu];
+
+    rq->idle.name = "idle";
+    rq->idle.cpu = cpu;
+    rq->idle.state = THREAD_RUNNING;
+    rq->idle.on_cpu = 1;
+    rq->idle.fpsimd_cpu = FPSIMD_CPU_NONE;
+    rq->curr = &rq->idle;
+    ktimer_init(&rq->slice, sched_slice_end, rq);
+    __atomic_store_n(&rq->online, true, __ATOMIC_RELEASE);
+}
+
+static void sched_ipi(unsigned int irq, void *arg) {
+    (void)irq;
+    (void)arg;
+    this_rq()->need_resched = true;
+}
+
+void sched_init(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), 16);
+    rq_init(0);
+    irq_register(IPI_RESCHEDULE, sched_ipi, NULL);
+}
+
+void sched_cpu_init(void) {
+    rq_init(cpu_id());
+    gic_enable_irq(IPI_RESCHEDULE);
+}
+
+struct thread *current_thread(void) {
+    unsigned long flags = local_irq_save();
+    struct thread *thread = this_rq()->curr;
+    local_irq_restore(flags);
+    return thread;
+}
+
+// Take a ready thread from the busiest other queue
+static struct thread *steal_thread(unsigned int self) {
+    struct runqueue *victim = NULL;
+    unsigned int most = 0;
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct runqueue *rq = &runqueues[cpu];
+        unsigned int nr = __atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED);
+
+        if (cpu != self && rq->online && nr > most) {
+            victim = rq;
+            most = nr;
+        }
+    }
+    if (!victim) {
+        return NULL;
+    }
+
+    struct thread *thread = NULL;
+    spin_lock(&victim->lock);
+    if (victim->head && !__atomic_load_n(&victim->head->on_cpu, __ATOMIC_ACQUIRE)) {
+        thread = rq_pop(victim);
+    }
+    spin_unlock(&victim->lock);
+    return thread;
+}
+
+// Wake one idle CPU so it comes and steals
+static void kick_idle_cpu(unsigned int self) {
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct runqueue *rq = &runqueues[cpu];
+
+        if (cpu != self && rq->online && rq->curr == &rq->idle) {
+            gic_send_sgi(cpu, IPI_RESCHEDULE);
+            return;
+        }
+    }
+}
+
+void sched_finish_switch(struct thread *prev) {
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+
+    if (prev->state == THREAD_DEAD) {
+        free_pages(prev->stack, THREAD_STACK_ORDER);
+        kmem_cache_free(thread_cache, prev);
+    }
+}
+
+void schedule(void) {
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = cpu_id();
+    struct runqueue *rq = &runqueues[cpu];
+    struct thread *prev = rq->curr;
+
+    rq->need_resched = false;
+    rcu_note_qs();
+
+    spin_lock(&rq->lock);
+    if (prev != &rq->idle && prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        rq_push(rq, prev);
+    }
+    struct thread *next = rq_pop(rq);
+    spin_unlock(&rq->lock);
+
+    if (!next) {
+        next = steal_thread(cpu);
+        if (next) {
+            rq->steals++;
+        } else {
+            next = &rq->idle;
+        }
+    }
+
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu;
+
+    // The idle thread gets no slice, so an idle CPU has no timer armed
+    // unless some other timeout is pending
+    if (next == &rq->idle) {
+        ktimer_cancel(&rq->slice);
+    } else {
+        ktimer_add_after(&rq->slice, SCHED_SLICE_NS);
+    }
+
+    if (next != prev) {
+        next->on_cpu = 1;
+        rq->curr = next;
+        rq->switches++;
+        stat_inc(STAT_CTX_SWITCHES);
+        fpsimd_switch(prev, next);
+        sched_finish_switch(cpu_switch_to(prev, next));
+    }
+
+    local_irq_restore(flags);
+}
+
+void sched_irq_exit(void) {
+    struct runqueue *rq = this_rq();
+
+    if (rq->need_resched && rq->curr->preempt_count == 0) {
+        schedule();
+    }
+}
+
+bool sched_work_pending(void) {
+    if (this_rq()->need_resched) {
+        return true;
+    }
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (__atomic_load_n(&runqueues[cpu].nr_ready, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct thread *thread_create(const char *name, thread_fn_t fn, void *arg) {
+    struct thread *thread = kmem_cache_alloc(thread_cache);
+    if (!thread) {
+        return NULL;
+    }
+
+    void *stack = alloc_pages(THREAD_STACK_ORDER);
+    if (!stack) {
+        kmem_cache_free(thread_cache, thread);
+        return NULL;
+    }
+
+    memset(thread, 0, sizeof(*thread));
+    thread->name = name;
+    thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->stack = stack;
+    thread->state = THREAD_READY;
+    thread->fpsimd_cpu = FPSIMD_CPU_NONE;
+    thread->ctx.x19 = (uintptr_t)fn;
+    thread->ctx.x20 = (uintptr_t)arg;
+    thread->ctx.sp = (uintptr_t)stack + (PAGE_SIZE << THREAD_STACK_ORDER);
+    thread->ctx.pc = (uintptr_t)thread_start;
+
+    unsigned long flags = local_irq_save();
+    unsigned int cpu = cpu_id();
+    struct runqueue *rq = &runqueues[cpu];
+
+    spin_lock(&rq->lock);
+    thread->cpu = cpu;
+    rq_push(rq, thread);
+    spin_unlock(&rq->lock);
+
+    kick_idle_cpu(cpu);
+    local_irq_restore(flags);
+    return thread;
+}
+
+void thread_yield(void) {
+    schedule();
+}
+
+void thread_exit(void) {
+    local_irq_disable();
+    this_rq()->curr->state = THREAD_DEAD;
+    schedule();
+    __builtin_unreachable();
+}
+
+void preempt_disable(void) {
+    unsigned long flags = local_irq_save();
+    this_rq()->curr->preempt_count++;
+    local_irq_restore(flags);
+}
+
+void preempt_enable(void) {
+    unsigned long flags = local_irq_save();
+    struct runqueue *rq = this_rq();
+
+    if (--rq->curr->preempt_count == 0 && rq->need_resched) {
+        schedule();
+    }
+    local_irq_restore(flags);
+}
+
+void sched_dump(void) {
+    LOG_INFO("sched: run queues\n");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct runqueue *rq = &runqueues[cpu];
+
+        if (rq->online) {
+            printk("        cpu%u: %u ready, running %s, %lu switches, %lu steals\n",
+                   cpu, rq->nr_ready, rq->curr->name, rq->switches, rq->steals);
+        }
+    }
+}
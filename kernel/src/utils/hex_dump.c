@@ -1,45 +1,103 @@
-#include "stddef.h"
+#include <stddef.h>
+#include <stdint.h>
 #include "lib/printk.h"
+#include "lib/string.h"
 
-void hex_dump(void *addr, size_t len) {
-    unsigned char *ptr = (unsigned char *)addr;
-
-    unsigned long num_addr = (unsigned long)ptr;
-    unsigned long aligned_addr = num_addr & ~ 0xF;
-
-    for (unsigned long row_addr = aligned_addr; row_addr < num_addr + len; row_addr += 16) {
-        printk("0x%x:    ", row_addr);   
-        
-        for (int col = 0; col < 16; col++){
-            unsigned long byte_addr = row_addr + col;
-        
-            if (byte_addr < num_addr || byte_addr >= num_addr + len) {
-                printk(".. ");  
-            } else {
-                unsigned char byte = *(unsigned char *)byte_addr;
-                if (byte < 0x10) {
-                    printk("0");  
-                }
-                printk("%x ", byte );
-            }
-        } 
-        
-        printk("   ");
-        for (int col = 0; col < 16; col++){
-            unsigned long byte_addr = row_addr + col;
-        
-            if (byte_addr < num_addr || byte_addr >= num_addr + len) {
-                printk(".");  
-            } else {
-                unsigned char byte = *(unsigned char *)byte_addr;
-                if (byte > 31 && byte < 127) {
-                    printk("%c", byte); 
-                } else {
-                    printk(".");  
-                }
-            }
-        } 
-
-        printk("\n");
+// Each 16-byte row is formatted in one pass into a line buffer: every byte
+// is read once and written to both its hex and its ASCII column, then the
+// whole line goes out as a single record.
+//
+//   0x400010a0:    48 65 6c ... 21 00 .. ..    Hello, World!...
+//   ^address       ^hex                        ^ASCII
+
+#define ROW_BYTES   16
+#define ADDR_MAX    (2 + 16 + 5)                // "0x" + digits + ":    "
+#define HEX_SEP     3                           // "   " before the ASCII
+#define ROW_MAX     (ADDR_MAX + ROW_BYTES * 3 + HEX_SEP + ROW_BYTES + 1)
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+// Format the row starting at row into line (not NUL-terminated); bytes
+// outside [start, end) are shown as "..". Returns the line length.
+static size_t hex_dump_row(char *line, uintptr_t row, uintptr_t start, uintptr_t end) {
+    char *p = line;
+    int digits = row ? (67 - __builtin_clzl(row)) >> 2 : 1;
+
+    *p++ = '0';
+    *p++ = 'x';
+    for (int i = digits - 1; i >= 0; i--) {
+        *p++ = hex_digits[(row >> (i * 4)) & 0xF];
     }
+    *p++ = ':';
+    for (int i = 0; i < 4; i++) {
+        *p++ = ' ';
+    }
+
+    char *hex = p;
+    char *ascii = p + ROW_BYTES * 3 + HEX_SEP;
+
+    for (int col = 0; col < ROW_BYTES; col++) {
+        uintptr_t addr = row + col;
+
+        if (addr < start || addr >= end) {
+            hex[0] = '.';
+            hex[1] = '.';
+            ascii[col] = '.';
+        } else {
+            uint8_t byte = *(const volatile uint8_t *)addr;
+
+            hex[0] = hex_digits[byte >> 4];
+            hex[1] = hex_digits[byte & 0xF];
+            ascii[col] = (byte > 31 && byte < 127) ? byte : '.';
+        }
+        hex[2] = ' ';
+        hex += 3;
+    }
+    for (int i = 0; i < HEX_SEP; i++) {
+        *hex++ = ' ';
+    }
+
+    ascii[ROW_BYTES] = '\n';
+    return ascii + ROW_BYTES + 1 - line;
+}
+
+void hex_dump(const void *addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + len;
+    char line[ROW_MAX + 1];
+
+    for (uintptr_t row = start & ~(uintptr_t)0xF; row < end; row += ROW_BYTES) {
+        line[hex_dump_row(line, row, start, end)] = '\0';
+        printk("%s", line);
+    }
+}
+
+size_t hex_dump_to(char *buf, size_t size, const void *addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + len;
+    size_t used = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    // Rows are only emitted whole, so a partial row never ends the buffer
+    for (uintptr_t row = start & ~(uintptr_t)0xF; row < end; row += ROW_BYTES) {
+        if (size - used > ROW_MAX) {
+            used += hex_dump_row(buf + used, row, start, end);
+            continue;
+        }
+
+        char line[ROW_MAX];
+        size_t n = hex_dump_row(line, row, start, end);
+
+        if (used + n >= size) {
+            break;
+        }
+        memcpy(buf + used, line, n);
+        used += n;
+    }
+
+    buf[used] = '\0';
+    return used;
 }
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""Receive binary streams (lib/binchan.c) from a Vilik OS console.
+
+The kernel sends memory snapshots, profiler and trace buffers as framed,
+checksummed and usually LZ4-compressed binary between its log lines. This
+tool passes the text through and writes every stream to a file:
+
+    make run | tools/binrecv.py -o dumps/
+    tools/binrecv.py -o dumps/ console.bin
+
+Files are named <type>-<stream>.bin, and memory-<address>.bin for memory
+dumps. A frame with a bad CRC is reported and skipped, so a damaged
+stream has a hole in it; it is still written, padded with zeros.
+
+The frame parser is importable: tools/profile.py uses it.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b'\x00\xa5VB'
+HEADER = struct.Struct('<4sBBHQII')
+CRC = struct.Struct('<I')
+
+F_LZ4 = 1 << 0
+F_LAST = 1 << 1
+TYPES = {1: 'memory', 2: 'profile', 3: 'trace', 4: 'log'}
+
+
+def lz4_decompress(block, raw_len):
+    """Decode one LZ4 block (the format lib/lz4.c writes)."""
+    out = bytearray()
+    i = 0
+    n = len(block)
+
+    def length(nibble):
+        nonlocal i
+        if nibble == 15:
+            while True:
+                b = block[i]
+                i += 1
+                nibble += b
+                if b != 255:
+                    break
+        return nibble
+
+    while i < n:
+        token = block[i]
+        i += 1
+        lit = length(token >> 4)
+        out += block[i:i + lit]
+        i += lit
+        if i >= n:
+            break
+        offset = block[i] | block[i + 1] << 8
+        i += 2
+        if offset == 0 or offset > len(out):
+            raise ValueError('bad LZ4 match offset')
+        match = length(token & 0xF) + 4
+        start = len(out) - offset
+        for k in range(match):      # may overlap its own output
+            out.append(out[start + k])
+
+    if len(out) != raw_len:
+        raise ValueError(f'LZ4 block decoded to {len(out)} bytes, expected {raw_len}')
+    return bytes(out)
+
+
+class Frame:
+    def __init__(self, type_, flags, stream, offset, data):
+        self.type = type_
+        self.flags = flags
+        self.stream = stream
+        self.offset = offset
+        self.data = data
+
+    @property
+    def last(self):
+        return bool(self.flags & F_LAST)
+
+
+class Parser:
+    """Incremental splitter: feed() bytes, get back text and frames."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.bad_frames = 0
+
+    def feed(self, data):
+        """Yield ('text', bytes) and ('frame', Frame) events."""
+        self.buf += data
+        while self.buf:
+            at = self.buf.find(MAGIC)
+            if at < 0:
+                # Keep a tail that could be the start of a magic
+                keep = next((k for k in range(len(MAGIC) - 1, 0, -1)
+                             if self.buf.endswith(MAGIC[:k])), 0)
+                text = bytes(self.buf[:len(self.buf) - keep])
+                del self.buf[:len(self.buf) - keep]
+                if text:
+                    yield 'text', text
+                return
+            if at:
+                yield 'text', bytes(self.buf[:at])
+                del self.buf[:at]
+
+            if len(self.buf) < HEADER.size:
+                return
+            _, type_, flags, stream, offset, raw_len, wire_len = HEADER.unpack_from(self.buf)
+            total = HEADER.size + wire_len + CRC.size
+            if wire_len > 2 * 65536 or raw_len > 65536:
+                # Not a real frame: treat the magic as text and move on
+                self.bad_frames += 1
+                yield 'text', bytes(self.buf[:1])
+                del self.buf[:1]
+                continue
+            if len(self.buf) < total:
+                return
+
+            body = bytes(self.buf[len(MAGIC):HEADER.size + wire_len])
+            crc, = CRC.unpack_from(self.buf, HEADER.size + wire_len)
+            if zlib.crc32(body) != crc:
+                # Drop the frame, but no further than the next magic in
+                # case it was the length that got damaged
+                self.bad_frames += 1
+                nxt = self.buf.find(MAGIC, 1, total)
+                del self.buf[:nxt if nxt > 0 else total]
+                continue
+
+            payload = body[HEADER.size - len(MAGIC):]
+            del self.buf[:total]
+            if flags & F_LZ4:
+                payload = lz4_decompress(payload, raw_len)
+            yield 'frame', Frame(type_, flags, stream, offset, payload)
+
+    def flush(self):
+        if self.buf:
+            yield 'text', bytes(self.buf)
+            self.buf.clear()
+
+
+class Stream:
+    def __init__(self, frame):
+        self.type = frame.type
+        self.id = frame.stream
+        self.start = frame.offset
+        self.data = bytearray()
+
+    def add(self, frame):
+        pos = frame.offset - self.start
+        if pos > len(self.data):
+            self.data += bytes(pos - len(self.data))    # a frame was lost
+        self.data[pos:pos + len(frame.data)] = frame.data
+
+    @property
+    def name(self):
+        kind = TYPES.get(self.type, f'type{self.type}')
+        if kind == 'memory':
+            return f'memory-{self.start:x}.bin'
+        return f'{kind}-{self.id}.bin'
+
+
+class Receiver:
+    """Parser plus stream reassembly. feed() returns the text seen and the
+    streams completed by this data; finish() returns unterminated ones."""
+
+    def __init__(self):
+        self.parser = Parser()
+        self.open = {}
+
+    def _handle(self, events):
+        text = bytearray()
+        done = []
+        for kind, value in events:
+            if kind == 'text':
+                text += value
+                continue
+            s = self.open.get(value.stream)
+            if s is None or s.type != value.type:
+                s = self.open[value.stream] = Stream(value)
+            s.add(value)
+            if value.last:
+                done.append(self.open.pop(value.stream))
+        return bytes(text), done
+
+    def feed(self, data):
+        return self._handle(self.parser.feed(data))
+
+    def finish(self):
+        text, done = self._handle(self.parser.flush())
+        partial = list(self.open.values())
+        self.open.clear()
+        return text, done, partial
+
+    @property
+    def bad_frames(self):
+        return self.parser.bad_frames
+
+
+def streams(data):
+    """Parse a whole capture: (text, streams, damaged frame count)."""
+    recv = Receiver()
+    text, done = recv.feed(data)
+    tail, more, partial = recv.finish()
+    return text + tail, done + more + partial, recv.bad_frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('input', nargs='?', help='console capture (default: stdin)')
+    parser.add_argument('-o', '--outdir', default='.',
+                        help='directory for the received streams')
+    args = parser.parse_args()
+
+    src = open(args.input, 'rb') if args.input else sys.stdin.buffer
+    out = sys.stdout.buffer
+    os.makedirs(args.outdir, exist_ok=True)
+
+    def save(streams, partial=False):
+        for stream in streams:
+            path = os.path.join(args.outdir, stream.name)
+            with open(path, 'wb') as f:
+                f.write(stream.data)
+            note = ' (incomplete)' if partial else ''
+            print(f'binrecv: {path}: {len(stream.data)} bytes{note}', file=sys.stderr)
+
+    def show(text):
+        out.write(text)
+        out.flush()
+
+    recv = Receiver()
+    try:
+        while True:
+            data = src.read1(65536) if hasattr(src, 'read1') else src.read(65536)
+            if not data:
+                break
+            text, done = recv.feed(data)
+            show(text)
+            save(done)
+    except KeyboardInterrupt:
+        pass
+
+    text, done, partial = recv.finish()
+    show(text)
+    save(done)
+    save(partial, partial=True)
+    if recv.bad_frames:
+        print(f'binrecv: {recv.bad_frames} damaged frames skipped', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
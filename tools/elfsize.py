@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Print the section sizes of a kernel image after a link.
+
+The Makefile runs this after every link, so image growth shows up when it
+happens rather than as slower boots later:
+
+    tools/elfsize.py kernel.elf
+    tools/elfsize.py --compare build/size.json --save build/size.json kernel.elf
+    tools/elfsize.py --top 30 kernel.elf        # also the largest symbols
+
+Loaded bytes are what QEMU copies into RAM (PROGBITS sections); the
+footprint also counts .bss, the page tables and the stacks, up to
+__kernel_end.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+STT_OBJECT = 1
+STT_FUNC = 2
+
+
+def read_elf(path):
+    """(sections, symbols) of an ELF64 file: sections as (name, addr,
+    size, loaded) in address order, symbols as (name, size, kind)."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:4] != b'\x7fELF' or data[4] != 2:
+        raise ValueError(f'{path}: not an ELF64 file')
+
+    shoff, = struct.unpack_from('<Q', data, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', data, 0x3A)
+    headers = []
+    for i in range(shnum):
+        base = shoff + i * shentsize
+        headers.append(struct.unpack_from('<IIQQQQI', data, base))
+
+    def string(table, off):
+        start = headers[table][4] + off
+        return data[start:data.index(b'\0', start)].decode('utf-8', 'replace')
+
+    sections = []
+    symbols = []
+    for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link in headers:
+        if sh_flags & SHF_ALLOC and sh_size:
+            sections.append((string(shstrndx, sh_name), sh_addr, sh_size,
+                             sh_type != SHT_NOBITS))
+        if sh_type != SHT_SYMTAB:
+            continue
+        for off in range(sh_offset, sh_offset + sh_size, 24):
+            st_name, st_info, _, st_shndx, _, st_size = \
+                struct.unpack_from('<IBBHQQ', data, off)
+            kind = st_info & 0xF
+            if kind in (STT_FUNC, STT_OBJECT) and st_shndx and st_size:
+                symbols.append((string(sh_link, st_name), st_size,
+                                'func' if kind == STT_FUNC else 'data'))
+
+    sections.sort(key=lambda s: s[1])
+    return sections, symbols
+
+
+def delta(now, before):
+    if before is None:
+        return ''
+    diff = now - before
+    return f'{diff:+d}' if diff else ''
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('elf', help='the linked kernel (kernel.elf)')
+    parser.add_argument('--compare', metavar='JSON',
+                        help='show the change against sizes saved by an earlier run')
+    parser.add_argument('--save', metavar='JSON', help='save the sizes for --compare')
+    parser.add_argument('--top', type=int, default=0,
+                        help='also list the largest functions and objects')
+    args = parser.parse_args()
+
+    try:
+        sections, symbols = read_elf(args.elf)
+    except (OSError, ValueError, struct.error, IndexError) as e:
+        sys.exit(f'elfsize: {e}')
+
+    before = {}
+    if args.compare:
+        try:
+            with open(args.compare) as f:
+                before = json.load(f)
+        except (OSError, ValueError):
+            pass
+
+    sizes = {name: size for name, _, size, _ in sections}
+    sizes['loaded'] = sum(size for _, _, size, loaded in sections if loaded)
+    sizes['footprint'] = (sections[-1][1] + sections[-1][2] - sections[0][1]
+                          if sections else 0)
+
+    print(f'{"section":<12} {"address":>18} {"size":>9} {"change":>8}')
+    for name, addr, size, loaded in sections:
+        kind = '' if loaded else '  (not loaded)'
+        print(f'{name:<12} {addr:#18x} {size:9} {delta(size, before.get(name)):>8}{kind}')
+    for name in ('loaded', 'footprint'):
+        print(f'{name:<12} {"":>18} {sizes[name]:9} {delta(sizes[name], before.get(name)):>8}')
+
+    if args.top:
+        print()
+        print(f'{"size":>9}  {"kind":<4}  symbol')
+        for name, size, kind in sorted(symbols, key=lambda s: -s[1])[:args.top]:
+            print(f'{size:9}  {kind:<4}  {name}')
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump(sizes, f, indent=1, sort_keys=True)
+
+
+if __name__ == '__main__':
+    main()
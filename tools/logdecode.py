@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Expand deferred log records in a Vilik OS console log.
+
+A kernel built with `make LOG_DEFERRED=host` prints deferred records
+(LOG_DEFER, and LOG_WARN/INFO/DEBUG in that build) undecoded:
+
+    [    0.001234] cpu0 #D 40003a18 2a 40003a30
+
+i.e. the address of the format string followed by the raw 64-bit
+arguments. This tool looks the format string (and any %s arguments) up
+in kernel.elf and prints the line the kernel would have printed:
+
+    make run | tools/logdecode.py kernel.elf
+    tools/logdecode.py kernel.elf serial.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+RECORD = re.compile(r'^(?P<prefix>.*?)#D (?P<fmt>[0-9a-f]+)(?P<args>(?: [0-9a-f]+)*)\r?$')
+SPEC = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?([lh]?)([diuxXpcs%])')
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+
+class Elf:
+    """Just enough ELF64 to read C strings at virtual addresses."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 2:
+            raise ValueError(f'{path}: not an ELF64 file')
+
+        shoff, = struct.unpack_from('<Q', self.data, 0x28)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x3A)
+        self.sections = []
+        for i in range(shnum):
+            base = shoff + i * shentsize
+            sh_type, sh_flags, sh_addr, sh_offset, sh_size = \
+                struct.unpack_from('<IQQQQ', self.data, base + 4)
+            if sh_type == SHT_PROGBITS and sh_flags & SHF_ALLOC:
+                self.sections.append((sh_addr, sh_offset, sh_size))
+
+    def string(self, addr):
+        for sh_addr, sh_offset, sh_size in self.sections:
+            if sh_addr <= addr < sh_addr + sh_size:
+                start = sh_offset + addr - sh_addr
+                end = self.data.index(b'\0', start)
+                return self.data[start:end].decode('utf-8', 'replace')
+        return None
+
+
+def to_signed(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def format_record(elf, fmt, args):
+    """Apply the kernel's printk rules to fmt with raw 64-bit args."""
+    args = list(args)
+    out = []
+    pos = 0
+
+    def next_arg():
+        return args.pop(0) if args else 0
+
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, precision, length, conv = m.groups()
+        spec = '%' + flags + width + ('.' + precision if precision else '')
+        bits = 64 if length == 'l' else 32
+
+        if conv == '%':
+            out.append('%')
+        elif conv in 'di':
+            out.append((spec + 'd') % to_signed(next_arg(), bits))
+        elif conv in 'uxX':
+            value = next_arg() & ((1 << bits) - 1)
+            out.append((spec + ('d' if conv == 'u' else conv)) % value)
+        elif conv == 'c':
+            out.append(chr(next_arg() & 0xFF))
+        elif conv == 'p':
+            value = next_arg()
+            out.append('(nil)' if value == 0 else '0x%016x' % value)
+        elif conv == 's':
+            addr = next_arg()
+            text = '(null)' if addr == 0 else elf.string(addr)
+            if text is None:
+                text = '<str@0x%x>' % addr
+            out.append((spec + 's') % text)
+
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('elf', help='kernel.elf the log came from')
+    parser.add_argument('log', nargs='?', help='console log (default: stdin)')
+    opts = parser.parse_args()
+
+    elf = Elf(opts.elf)
+    src = open(opts.log, errors='replace') if opts.log else sys.stdin
+
+    for line in src:
+        line = line.rstrip('\n')
+        m = RECORD.match(line)
+        if not m:
+            print(line)
+            continue
+
+        fmt = elf.string(int(m.group('fmt'), 16))
+        if fmt is None:
+            print(line)
+            continue
+
+        args = [int(a, 16) for a in m.group('args').split()]
+        sys.stdout.write(m.group('prefix') + format_record(elf, fmt, args))
+        if not fmt.endswith('\n'):
+            sys.stdout.write('\n')
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Boot bench.elf headless and check it against a performance baseline.
+
+`make perfcheck` builds the benchmark kernel and runs this tool, which
+boots it in QEMU with the console on a pipe, collects the boot phase
+table (lib/boottime.c) and every `bench:` line from the serial output,
+and compares them with the numbers saved by an earlier run:
+
+    tools/perfcheck.py bench.elf                     # compare, exit 1 on a regression
+    tools/perfcheck.py --save bench.elf              # record a new baseline
+    tools/perfcheck.py --smp 1 --mem 512M --runs 5 bench.elf
+    tools/perfcheck.py --console run.log bench.elf   # parse a capture, no QEMU
+
+A metric regresses when it is more than --threshold percent above the
+baseline and also more than the noise floor for its kind. Each metric is
+the minimum over --runs boots, which removes most of the noise that
+host load and IRQs add to a single run. Metrics that only one side has
+are listed and never fail the check.
+
+The baseline stores the QEMU configuration it was taken with; comparing
+runs with a different one is refused. Under plain TCG the emulated clock
+follows the host, so a baseline only holds for the machine it was taken
+on. --icount SHIFT makes QEMU count time in instructions instead, which
+gives the same numbers on any host.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+# [    0.012345] cpu0 , in front of every log record
+PREFIX = re.compile(r'^\[\s*\d+\.\d+\] cpu\d+ ')
+BOOT_HEADER = re.compile(r'^\s+phase\s+at\s+took\s*$')
+BOOT_ROW = re.compile(r'^\s+(\S+)\s+(\d+)\s+(\d+)\s*$')
+BENCH = re.compile(r'^bench: (\S+) n=\d+ min=(\d+) med=(\d+) p99=(\d+) (\w+)\s*$')
+
+
+def parse(text):
+    """Metrics of one console capture: {name: (value, unit)}.
+
+    boot.<phase> is the time a phase took and boot.total the time from
+    _start to the last mark, in us. bench.<case> is the median of a case
+    and bench.<case>.min its minimum. p99 mostly measures the host and is
+    not checked."""
+    metrics = {}
+    in_table = False
+
+    for line in text.splitlines():
+        line = PREFIX.sub('', line)
+        if BOOT_HEADER.match(line):
+            in_table = True
+            continue
+        if in_table:
+            m = BOOT_ROW.match(line)
+            if m:
+                metrics[f'boot.{m[1]}'] = (int(m[3]), 'us')
+                metrics['boot.total'] = (int(m[2]), 'us')
+                continue
+            in_table = False
+
+        m = BENCH.match(line)
+        if m:
+            metrics[f'bench.{m[1]}'] = (int(m[3]), m[5])
+            metrics[f'bench.{m[1]}.min'] = (int(m[2]), m[5])
+    return metrics
+
+
+def qemu_command(args):
+    cmd = [args.qemu, '-M', f'virt,gic-version={args.gic}', '-cpu', args.cpu,
+           '-m', args.mem, '-smp', str(args.smp),
+           '-global', 'virtio-mmio.force-legacy=false',
+           '-display', 'none', '-monitor', 'none', '-serial', 'stdio',
+           '-kernel', args.elf]
+    if args.icount is not None:
+        cmd += ['-icount', f'shift={args.icount}']
+    return cmd
+
+
+def boot(args):
+    """Console output of one boot. The bench kernel powers off when it is
+    done, which ends QEMU."""
+    try:
+        result = subprocess.run(qemu_command(args), stdin=subprocess.DEVNULL,
+                                stdout=subprocess.PIPE, timeout=args.timeout)
+    except subprocess.TimeoutExpired:
+        sys.exit(f'perfcheck: no power-off within {args.timeout} s')
+    except OSError as e:
+        sys.exit(f'perfcheck: {args.qemu}: {e.strerror}')
+    text = result.stdout.decode('utf-8', 'replace')
+    if result.returncode:
+        sys.exit(f'perfcheck: QEMU exited with status {result.returncode}\n{text}')
+    return text
+
+
+def collect(args):
+    """The per-metric minimum over all runs."""
+    best = {}
+
+    for i in range(args.runs):
+        if args.console:
+            with open(args.console, 'rb') as f:
+                text = f.read().decode('utf-8', 'replace')
+        else:
+            text = boot(args)
+        if args.log:
+            with open(args.log, 'w' if i == 0 else 'a') as f:
+                f.write(text)
+
+        metrics = parse(text)
+        if not any(name.startswith('bench.') for name in metrics):
+            sys.exit('perfcheck: no bench: lines in the console output; '
+                     'is this a make bench kernel?')
+        for name, (value, unit) in metrics.items():
+            if name not in best or value < best[name][0]:
+                best[name] = (value, unit)
+        if args.console:
+            break
+    return best
+
+
+def config(args):
+    return {'smp': args.smp, 'mem': args.mem, 'cpu': args.cpu,
+            'gic': args.gic, 'icount': args.icount}
+
+
+def compare(metrics, baseline, args):
+    """Print a table against the baseline; the number of regressions."""
+    before = baseline['metrics']
+    regressions = 0
+
+    print(f'{"metric":<36} {"baseline":>10} {"now":>10} {"change":>8}')
+    for name in sorted(set(metrics) | set(before)):
+        if name not in metrics:
+            print(f'{name:<36} {before[name][0]:>10} {"-":>10} {"gone":>8}')
+            continue
+        value, unit = metrics[name]
+        if name not in before:
+            print(f'{name:<36} {"-":>10} {value:>10} {"new":>8}')
+            continue
+
+        base, base_unit = before[name]
+        if unit != base_unit:
+            print(f'{name:<36} {base:>7} {base_unit:<2} {value:>7} {unit:<2} {"unit":>8}')
+            continue
+
+        floor = args.boot_floor if name.startswith('boot.') else args.bench_floor
+        change = (value - base) * 100.0 / base if base else 0.0
+        bad = value - base > floor and value > base * (1 + args.threshold / 100.0)
+        regressions += bad
+        print(f'{name:<36} {base:>10} {value:>10} {change:>+7.1f}%'
+              f'{"  REGRESSION" if bad else ""}')
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('elf', nargs='?', default='bench.elf',
+                        help='the benchmark kernel (default bench.elf)')
+    parser.add_argument('--baseline', default='perf/baseline.json',
+                        help='saved results to compare with (default perf/baseline.json)')
+    parser.add_argument('--save', action='store_true',
+                        help='write the results as the new baseline instead of comparing')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='percent above the baseline that fails (default 10)')
+    parser.add_argument('--boot-floor', type=int, default=100,
+                        help='ignore boot phase changes up to this many us (default 100)')
+    parser.add_argument('--bench-floor', type=int, default=10,
+                        help='ignore benchmark changes up to this many cycles or ns '
+                             '(default 10)')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='boots to take the minimum of (default 3)')
+    parser.add_argument('--smp', type=int, default=4, help='cores (default 4)')
+    parser.add_argument('--mem', default='256M', help='RAM (default 256M)')
+    parser.add_argument('--cpu', default='cortex-a53', help='QEMU -cpu (default cortex-a53)')
+    parser.add_argument('--gic', type=int, default=2, help='GIC version (default 2)')
+    parser.add_argument('--icount', type=int, metavar='SHIFT',
+                        help='run QEMU with -icount shift=SHIFT, for numbers that '
+                             'do not depend on the host')
+    parser.add_argument('--qemu', default='qemu-system-aarch64', help='QEMU binary')
+    parser.add_argument('--timeout', type=int, default=300,
+                        help='seconds one boot may take (default 300)')
+    parser.add_argument('--console', metavar='FILE',
+                        help='parse this console capture instead of booting QEMU')
+    parser.add_argument('--log', metavar='FILE', help='also save the console output')
+    args = parser.parse_args()
+
+    if args.runs < 1:
+        parser.error('--runs must be at least 1')
+    if not args.console and not os.path.exists(args.elf):
+        sys.exit(f'perfcheck: {args.elf}: no such file; run make perfcheck')
+
+    metrics = collect(args)
+
+    if args.save:
+        os.makedirs(os.path.dirname(args.baseline) or '.', exist_ok=True)
+        with open(args.baseline, 'w') as f:
+            json.dump({'config': config(args), 'metrics': metrics}, f,
+                      indent=1, sort_keys=True)
+            f.write('\n')
+        print(f'perfcheck: {len(metrics)} metrics saved to {args.baseline}')
+        return
+
+    try:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    except OSError:
+        sys.exit(f'perfcheck: no baseline at {args.baseline}; '
+                 'record one with make perfcheck PERF_SAVE=1')
+    except ValueError as e:
+        sys.exit(f'perfcheck: {args.baseline}: {e}')
+
+    if baseline.get('config') != config(args):
+        sys.exit(f'perfcheck: baseline was taken with {baseline.get("config")}, '
+                 f'this run is {config(args)}')
+
+    regressions = compare(metrics, baseline, args)
+    if regressions:
+        sys.exit(f'perfcheck: {regressions} regressions over {args.threshold:g}%')
+    print('perfcheck: no regressions')
+
+
+if __name__ == '__main__':
+    main()
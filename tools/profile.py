@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Symbolize the samples of a `make profile` run.
+
+The profile build samples the PC (plus a frame-pointer backtrace) on the
+PMU cycle-counter interrupt and, when the demo is over, sends every
+sample as a profile stream over the binary channel (lib/binchan.h, see
+kernel/include/profile/profile.h). This tool prints the console text
+around it and a profile against the ELF's symbol table:
+
+    tools/profile.py profile.elf build/profile/console.bin
+    tools/profile.py --folded profile.elf console.bin | flamegraph.pl > boot.svg
+    tools/profile.py --hot 32 profile.elf console.bin > hot.ld   # make pgo
+
+The flat profile lists self samples (the PC was in the function) and
+total samples (the function was anywhere on the backtrace). Time spent
+with IRQs masked shows up at the point where they are unmasked again.
+"""
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+import binrecv
+
+HEADER = struct.Struct('<IIQII')
+PROFILE_STREAM = 2      # BINCHAN_PROFILE
+
+SHT_SYMTAB = 2
+STT_NOTYPE = 0
+STT_FUNC = 2
+
+
+class Symbols:
+    """Function symbols of an ELF64 file, for address lookup."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        if data[:4] != b'\x7fELF' or data[4] != 2:
+            raise ValueError(f'{path}: not an ELF64 file')
+
+        shoff, = struct.unpack_from('<Q', data, 0x28)
+        shentsize, shnum = struct.unpack_from('<HH', data, 0x3A)
+        sections = []
+        for i in range(shnum):
+            base = shoff + i * shentsize
+            sh_type, = struct.unpack_from('<I', data, base + 4)
+            sh_offset, sh_size, sh_link = struct.unpack_from('<QQI', data, base + 0x18)
+            sections.append((sh_type, sh_offset, sh_size, sh_link))
+
+        syms = {}
+        for sh_type, sh_offset, sh_size, sh_link in sections:
+            if sh_type != SHT_SYMTAB:
+                continue
+            strtab = sections[sh_link][1]
+            for off in range(sh_offset, sh_offset + sh_size, 24):
+                st_name, st_info, _, st_shndx, st_value, st_size = \
+                    struct.unpack_from('<IBBHQQ', data, off)
+                if st_info & 0xF not in (STT_FUNC, STT_NOTYPE) or not st_shndx:
+                    continue
+                end = data.index(b'\0', strtab + st_name)
+                name = data[strtab + st_name:end].decode('utf-8', 'replace')
+                # Skip mapping symbols ($x, $d), local labels and linker
+                # script markers (__kernel_start, __bss_end, ...)
+                if not name or name.startswith(('$', '.L')):
+                    continue
+                if st_info & 0xF == STT_NOTYPE and name.startswith('__'):
+                    continue
+                # Prefer the sized (C) symbol when an address has several
+                if st_value not in syms or st_size > syms[st_value][1]:
+                    syms[st_value] = (name, st_size)
+
+        self.addrs = sorted(syms)
+        self.names = [syms[a][0] for a in self.addrs]
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        return self.names[i] if i >= 0 else f'0x{addr:x}'
+
+
+def parse(blob):
+    """Split a console capture into (text, header, samples)."""
+    text, streams, bad = binrecv.streams(blob)
+    profile = [st for st in streams if st.type == PROFILE_STREAM]
+    if not profile:
+        raise ValueError('no profile stream in the console output')
+    if bad:
+        print(f'profile: {bad} damaged frames skipped', file=sys.stderr)
+
+    data = bytes(profile[-1].data)
+    depth, period, base, count, dropped = HEADER.unpack_from(data)
+    samples = []
+    pos = HEADER.size
+    for _ in range(count):
+        cpu, n = data[pos], data[pos + 1]
+        if not 1 <= n <= depth:
+            raise ValueError(f'corrupt sample at offset {pos}')
+        offsets = struct.unpack_from(f'<{n}I', data, pos + 2)
+        samples.append((cpu, [base + o for o in offsets]))
+        pos += 2 + 4 * n
+
+    info = {'period': period, 'dropped': dropped, 'depth': depth}
+    return text.decode('utf-8', 'replace'), info, samples
+
+
+def frames(syms, pcs):
+    """Function names from the sampled PC outwards. Return addresses point
+    after the call, so look up the instruction before them."""
+    return [syms.lookup(pc if i == 0 else pc - 4) for i, pc in enumerate(pcs)]
+
+
+def flat(syms, info, samples, limit, out):
+    self_count = collections.Counter()
+    total_count = collections.Counter()
+    per_cpu = collections.Counter()
+
+    for cpu, pcs in samples:
+        names = frames(syms, pcs)
+        self_count[names[0]] += 1
+        total_count.update(set(names))
+        per_cpu[cpu] += 1
+
+    n = len(samples) or 1
+    cpus = ', '.join(f'cpu{c}: {per_cpu[c]}' for c in sorted(per_cpu))
+    print(f'{len(samples)} samples every {info["period"]} cycles, '
+          f'{info["dropped"]} dropped ({cpus})', file=out)
+    print(f'{"self":>7} {"self%":>6} {"total":>7} {"total%":>6}  function', file=out)
+    for name, count in self_count.most_common(limit):
+        total = total_count[name]
+        print(f'{count:7} {100 * count / n:5.1f}% {total:7} {100 * total / n:5.1f}%  {name}',
+              file=out)
+
+
+def folded(syms, samples, out):
+    stacks = collections.Counter()
+    for _, pcs in samples:
+        stacks[';'.join(reversed(frames(syms, pcs)))] += 1
+    for stack, count in sorted(stacks.items()):
+        print(f'{stack} {count}', file=out)
+
+
+def hot(syms, samples, limit, out):
+    """Linker script lines for the functions with the most self samples.
+    A function may be renamed by the compiler (foo.constprop.0,
+    foo.lto_priv.0), so match on the name before the first dot."""
+    self_count = collections.Counter()
+    for _, pcs in samples:
+        self_count[frames(syms, pcs)[0].split('.')[0]] += 1
+
+    print('/* Generated by tools/profile.py --hot: the hottest functions of a '
+          'make profile run */', file=out)
+    for name, _ in self_count.most_common(limit):
+        if not name.startswith('0x'):
+            print(f'*(.text.{name} .text.{name}.*)', file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('elf', help='the profile kernel (profile.elf)')
+    parser.add_argument('console', help='console capture containing the profile block')
+    parser.add_argument('--folded', action='store_true',
+                        help='print folded stacks for flamegraph.pl instead')
+    parser.add_argument('--hot', type=int, metavar='N',
+                        help='print a linker script fragment placing the N hottest '
+                             'functions together (make pgo) instead')
+    parser.add_argument('--top', type=int, default=25,
+                        help='functions in the flat profile (default 25)')
+    parser.add_argument('--quiet', action='store_true',
+                        help='do not echo the console text')
+    args = parser.parse_args()
+
+    try:
+        syms = Symbols(args.elf)
+        with open(args.console, 'rb') as f:
+            text, info, samples = parse(f.read())
+    except (OSError, ValueError) as e:
+        sys.exit(f'profile: {e}')
+    except (struct.error, IndexError):
+        sys.exit('profile: profile stream truncated')
+
+    if args.folded:
+        folded(syms, samples, sys.stdout)
+        return
+    if args.hot:
+        hot(syms, samples, args.hot, sys.stdout)
+        return
+    if not args.quiet:
+        sys.stdout.write(text)
+        print()
+    flat(syms, info, samples, args.top, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()